@@ -0,0 +1,99 @@
+(* SPDX-License-Identifier: MIT *)
+module Boxroot_ref = Ref.Boxroot_ref
+
+(* OCaml 5 only. Tests of roots used across domains, for the
+   implementations of boxroot (REF=boxroot, the default, rem_boxroot
+   or dll_boxroot). Fails with an exception if a check fails.
+
+REF=boxroot ./benchmarks/cross_domain.exe
+*)
+
+module type Ref = sig
+  type 'a t
+  val create : 'a -> 'a t
+  val get : 'a t -> 'a
+  val delete : 'a t -> unit
+  val setup : unit -> unit
+  val teardown : unit -> unit
+end
+
+let implem_name =
+  match Sys.getenv "REF" with
+  | exception Not_found -> "boxroot"
+  | s -> s
+
+let implem : (module Ref) =
+  match implem_name with
+  | "boxroot" -> (module Boxroot_ref)
+  | "rem_boxroot" -> (module Ref.Rem_boxroot_ref)
+  | "dll_boxroot" -> (module Ref.Dll_boxroot_ref)
+  | s -> Printf.ksprintf failwith "Invalid environment variable REF=%s" s
+
+external migrate : 'a Boxroot_ref.t -> 'a Boxroot_ref.t
+  = "cross_domain_migrate"
+external pool_roots : 'a Boxroot_ref.t -> int = "cross_domain_pool_roots"
+
+let check name b =
+  if not b then Printf.ksprintf failwith "cross_domain: %s" name
+
+(* A domain roots a young value allocated by another domain. The root
+   must be updated when the value is promoted. *)
+let test_foreign_young (module R : Ref) =
+  let cell = Atomic.make None in
+  let d = Domain.spawn (fun () ->
+      let rec wait () =
+        match Atomic.get cell with
+        | None -> Domain.cpu_relax (); wait ()
+        | Some v -> R.create v
+      in
+      wait ())
+  in
+  (* A young value of the main domain, allocated after the spawn *)
+  let v = Bytes.make 16 'b' in
+  Atomic.set cell (Some v);
+  let r = Domain.join d in
+  Gc.minor ();
+  check "foreign young value after a minor collection" (R.get r == v);
+  Gc.full_major ();
+  check "foreign young value after a major collection" (R.get r == v);
+  check "contents of the foreign young value"
+    (Bytes.to_string (R.get r) = String.make 16 'b');
+  R.delete r
+
+(* A root created by one domain and migrated by another keeps its
+   value through collections, and its old slot is freed. *)
+let test_migrate () =
+  (* Keeps the pool of [r] non-empty, so that it is not freed *)
+  let keep = Boxroot_ref.create () in
+  (* A young value of the main domain *)
+  let v = Bytes.make 16 'a' in
+  let r = Boxroot_ref.create v in
+  let n = pool_roots r in
+  let r' = Domain.join (Domain.spawn (fun () ->
+      let r' = migrate r in
+      check "migrate moves the root" (r' != r);
+      check "value after migrate" (Boxroot_ref.get r' == v);
+      Gc.minor ();
+      check "value after a minor collection" (Boxroot_ref.get r' == v);
+      Gc.full_major ();
+      check "value after a major collection" (Boxroot_ref.get r' == v);
+      r'))
+  in
+  (* The owner merges the remote deallocation at its next scanning *)
+  Gc.minor ();
+  check "old slot freed" (pool_roots r = n - 1);
+  (* The pools of the terminated domain have been adopted *)
+  Gc.full_major ();
+  check "value after adoption" (Boxroot_ref.get r' == v);
+  check "contents after adoption"
+    (Bytes.to_string (Boxroot_ref.get r') = String.make 16 'a');
+  Boxroot_ref.delete r';
+  Boxroot_ref.delete keep
+
+let () =
+  let module R = (val implem) in
+  R.setup ();
+  test_foreign_young implem;
+  if implem_name = "boxroot" then test_migrate ();
+  Printf.printf "cross_domain (%s): ok\n" implem_name;
+  R.teardown ()
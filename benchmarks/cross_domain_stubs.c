@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: MIT */
+#define CAML_NAME_SPACE
+#include <caml/mlvalues.h>
+#include <caml/fail.h>
+
+#include "../boxroot/boxroot.h"
+
+/* Representation of Boxroot_ref.t (see lib-ref/gen_boxroot.h) */
+#define Boxroot_val(r) ((boxroot)((r) & ~((value)1)))
+#define Val_boxroot(b) ((value)(b) | (value)1)
+
+/* Migrate the boxroot [r] to the current domain, and complete the
+   remote deallocation of the old slot. */
+value cross_domain_migrate(value r)
+{
+  boxroot b = Boxroot_val(r);
+  if (!boxroot_migrate(&b)) caml_raise_out_of_memory();
+  boxroot_flush_releases();
+  return Val_boxroot(b);
+}
+
+/* Number of allocated slots in the pool of [r], which must not be
+   empty */
+value cross_domain_pool_roots(value r)
+{
+  boxroot_fl *fl = Get_pool_header(Boxroot_val(r));
+  return Val_int(fl->alloc_count);
+}
@@ -0,0 +1,61 @@
+(* SPDX-License-Identifier: MIT *)
+module Ref_config = Ref.Config
+module Ref = Ref_config.Ref
+
+(* OCaml 5 only. Minor pause times while domains keep terminating
+   and leaving roots behind (orphaned pools). At each round, DOMAINS
+   domains are spawned, each creates N roots, hands them over to the
+   main domain and terminates. The main domain deletes the roots of
+   the previous round, and measures the time of minor collections.
+
+REF=boxroot DOMAINS=16 N=10_000 ROUNDS=50 ./benchmarks/domain_churn.exe
+*)
+
+let get_param reader param default =
+  match Sys.getenv param with
+  | exception Not_found -> default
+  | s ->
+    try reader s
+    with _ -> Printf.ksprintf failwith "Invalid environment variable %s=%s" param s
+
+let domains = get_param int_of_string "DOMAINS" 16
+
+let n = get_param int_of_string "N" 10_000
+
+let rounds = get_param int_of_string "ROUNDS" 50
+
+let () =
+  Ref.setup ();
+  Printf.printf "%s (%d domains): %!" Ref_config.implem_name domains;
+  let total = ref 0. and peak = ref 0. and minors = ref 0 in
+  let measure_minor () =
+    let start = Unix.gettimeofday () in
+    Gc.minor ();
+    let t = Unix.gettimeofday () -. start in
+    incr minors;
+    total := !total +. t;
+    if t > !peak then peak := t
+  in
+  let start_time = Unix.gettimeofday () in
+  let previous = ref [||] in
+  for _round = 1 to rounds do
+    let workers =
+      List.init domains (fun _ ->
+          Domain.spawn (fun () ->
+              let roots = Array.init n (fun i -> Ref.create (ref i)) in
+              Gc.minor ();
+              roots))
+    in
+    measure_minor ();
+    let roots = Array.concat (List.map Domain.join workers) in
+    Array.iter Ref.delete !previous;
+    previous := roots;
+    measure_minor ()
+  done;
+  Array.iter Ref.delete !previous;
+  Printf.printf "%.2fs (minor: %.3fms avg, %.3fms peak)\n%!"
+    (Unix.gettimeofday () -. start_time)
+    (!total /. float !minors *. 1000.) (!peak *. 1000.);
+  if Ref_config.show_stats then
+    Ref.print_stats ();
+  Ref.teardown ()
@@ -4,8 +4,21 @@
 
    make -C .. benchmarks/globroots.exe \
    && REF=global CHOICE=persistent N=500_000 ./globroots.exe
+
+   With MODIFY_HEAVY=1, the long-lived roots are mostly updated with
+   young values, instead of the mix of operations of the original
+   test.
+
+   With DOMAINS=n (OCaml 5), the test is run in n domains at once,
+   each with its own roots. The time is the total CPU time.
 *)
 
+let modify_heavy =
+  match Sys.getenv "MODIFY_HEAVY" with
+  | "1" -> true
+  | _ -> false
+  | exception Not_found -> false
+
 module MakeTest(G: Ref.Config.Ref) = struct
 
   let size = 1024
@@ -48,9 +61,23 @@ module MakeTest(G: Ref.Config.Ref) = struct
         G.delete a.(i);
         a.(i) <- G.create vals.(i)
 
+  let change_modify_heavy () =
+    tick := (match !tick with (a,b) -> (b,a));
+    match Random.int 1000 with
+    | 0 ->
+        Gc.full_major()
+    | n when n < 20 ->
+        Gc.minor()
+    | n when n < 900 ->                 (* update with young value *)
+        let i = Random.int size in
+        G.modify a i (Int.to_string i)
+    | _ ->                              (* update with old value *)
+        let i = Random.int size in
+        G.modify a i vals.(i)
+
   let test n =
     for _i = 1 to n do
-      change();
+      if modify_heavy then change_modify_heavy () else change();
     done
 end
 
@@ -59,11 +86,17 @@ let n =
   with _ ->
     Printf.ksprintf failwith "We expected an environment variable N with an integer value."
 
+let domains =
+  try int_of_string (Sys.getenv "DOMAINS")
+  with Not_found -> 1
+
 let _ =
   Ref.Config.Ref.setup ();
-  Printf.printf "%s: %!" Ref.Config.implem_name;
-  let module Test = MakeTest(Ref.Config.Ref) in
-  Test.test n;
+  if domains = 1 then Printf.printf "%s: %!" Ref.Config.implem_name
+  else Printf.printf "%s (%d domains): %!" Ref.Config.implem_name domains;
+  ignore (Ref.Domains.run domains (fun _ ->
+      let module Test = MakeTest(Ref.Config.Ref) in
+      Test.test n));
   Printf.printf "%.2fs\n%!" (Sys.time ());
   if Ref.Config.show_stats then
     Ref.Config.Ref.print_stats ();
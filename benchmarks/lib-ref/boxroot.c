@@ -3,3 +3,96 @@
 
 #define MY_PREFIX /* empty string */
 #include "gen_boxroot.h"
+
+#include <caml/alloc.h>
+#include <caml/memory.h>
+
+/* Boxroot_ref.pool_counts */
+static value alloc_pool_counts(struct boxroot_pool_counts *c)
+{
+  value v = caml_alloc_small(3, 0);
+  Field(v, 0) = Val_long(c->young);
+  Field(v, 1) = Val_long(c->old);
+  Field(v, 2) = Val_long(c->free);
+  return v;
+}
+
+/* Initialise [v], a Boxroot_ref.counters allocated with
+   caml_alloc_small, from a boxroot_stats or a boxroot_domain_stats */
+#define Init_counters(v, s) do {                      \
+    Field(v, 0) = Val_long((s)->minor_collections);   \
+    Field(v, 1) = Val_long((s)->major_collections);   \
+    Field(v, 2) = Val_long((s)->create_slow);         \
+    Field(v, 3) = Val_long((s)->delete_slow);         \
+    Field(v, 4) = Val_long((s)->remote_flushes);      \
+    Field(v, 5) = Val_long((s)->handoffs);            \
+    Field(v, 6) = Val_long((s)->scanning_work_minor); \
+    Field(v, 7) = Val_long((s)->scanning_work_major); \
+    Field(v, 8) = Val_long((s)->minor_time_total);    \
+    Field(v, 9) = Val_long((s)->minor_time_peak);     \
+    Field(v, 10) = Val_long((s)->major_time_total);   \
+    Field(v, 11) = Val_long((s)->major_time_peak);    \
+  } while (0)
+#define Counters_size 12
+
+/* Boxroot_ref.domain_stats array */
+static value alloc_domain_stats()
+{
+  CAMLparam0();
+  CAMLlocal4(res, pools, counters, d);
+  struct boxroot_domain_stats s[Num_domains];
+  int n = 0;
+  for (int i = 0; i < Num_domains; i++)
+    if (boxroot_get_domain_stats(i, &s[n], sizeof(s[n])) != 0) n++;
+  res = caml_alloc_tuple(n);
+  for (int i = 0; i < n; i++) {
+    pools = alloc_pool_counts(&s[i].pools);
+    counters = caml_alloc_small(Counters_size, 0);
+    Init_counters(counters, &s[i]);
+    d = caml_alloc_small(3, 0);
+    Field(d, 0) = Val_int(s[i].domain_id);
+    Field(d, 1) = pools;
+    Field(d, 2) = counters;
+    Store_field(res, i, d);
+  }
+  CAMLreturn(res);
+}
+
+/* Boxroot_ref.stats */
+value boxroot_ref_get_stats(value unit)
+{
+  CAMLparam1(unit);
+  CAMLlocal4(res, counters, pools, domains);
+  struct boxroot_stats s;
+  boxroot_get_stats(&s, sizeof(s));
+  counters = caml_alloc_small(Counters_size, 0);
+  Init_counters(counters, &s);
+  pools = alloc_pool_counts(&s.pools);
+  domains = alloc_domain_stats();
+  res = caml_alloc_tuple(9);
+  Store_field(res, 0, counters);
+  Store_field(res, 1, Val_long(s.major_slices));
+  Store_field(res, 2, Val_long(s.alloced_pools));
+  Store_field(res, 3, Val_long(s.emptied_pools));
+  Store_field(res, 4, Val_long(s.freed_pools));
+  Store_field(res, 5, Val_long(s.live_pools));
+  Store_field(res, 6, Val_long(s.peak_pools));
+  Store_field(res, 7, pools);
+  Store_field(res, 8, domains);
+  CAMLreturn(res);
+}
+
+value boxroot_ref_scan_percentile(value major, value p)
+{
+  struct boxroot_scan_histogram h;
+  boxroot_get_scan_histogram(-1, &h, sizeof(h));
+  int kind = Bool_val(major) ? BOXROOT_SCAN_MAJOR : BOXROOT_SCAN_MINOR;
+  return Val_long(boxroot_scan_histogram_percentile(&h, kind,
+                                                    Double_val(p)));
+}
+
+value boxroot_ref_reset_stats(value unit)
+{
+  boxroot_reset_stats();
+  return unit;
+}
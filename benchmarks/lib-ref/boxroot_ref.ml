@@ -6,6 +6,106 @@ external modify : 'a t array -> int -> 'a -> unit = "boxroot_ref_modify" [@@noal
 external delete : 'a t -> unit       = "boxroot_ref_delete" [@@noalloc]
 
 external setup : unit -> unit = "boxroot_ref_setup"
+
 external teardown : unit -> unit = "boxroot_ref_teardown"
 
-external print_stats : unit -> unit = "boxroot_stats"
+external print_stats_text : unit -> unit = "boxroot_stats"
+
+(* See struct boxroot_stats in boxroot.h *)
+type pool_counts = { young : int; old : int; free : int }
+
+type counters = {
+  minor_collections : int;
+  major_collections : int;
+  create_slow : int;
+  delete_slow : int;
+  remote_flushes : int;
+  handoffs : int;
+  scanning_work_minor : int;
+  scanning_work_major : int;
+  minor_time_total : int;
+  minor_time_peak : int;
+  major_time_total : int;
+  major_time_peak : int;
+}
+
+type domain_stats = {
+  domain_id : int;
+  domain_pools : pool_counts;
+  domain_counters : counters;
+}
+
+type stats = {
+  counters : counters;
+  major_slices : int;
+  alloced_pools : int;
+  emptied_pools : int;
+  freed_pools : int;
+  live_pools : int;
+  peak_pools : int;
+  pools : pool_counts;
+  domains : domain_stats array;
+}
+
+external get_stats : unit -> stats = "boxroot_ref_get_stats"
+external reset_stats : unit -> unit = "boxroot_ref_reset_stats"
+
+(* Upper bound in ns of a percentile of the durations of the scanning
+   of roots at minor or major collections *)
+external scan_percentile : major:bool -> float -> int
+  = "boxroot_ref_scan_percentile"
+
+let json_of_pool_counts c =
+  Printf.sprintf {|{"young": %d, "old": %d, "free": %d}|} c.young c.old c.free
+
+let json_of_fields fields =
+  Printf.sprintf "{%s}" (String.concat ", "
+    (List.map (fun (k, v) -> Printf.sprintf "%S: %s" k v) fields))
+
+let counters_fields c = [
+  "minor_collections", string_of_int c.minor_collections;
+  "major_collections", string_of_int c.major_collections;
+  "create_slow", string_of_int c.create_slow;
+  "delete_slow", string_of_int c.delete_slow;
+  "remote_flushes", string_of_int c.remote_flushes;
+  "handoffs", string_of_int c.handoffs;
+  "scanning_work_minor", string_of_int c.scanning_work_minor;
+  "scanning_work_major", string_of_int c.scanning_work_major;
+  "minor_time_total_ns", string_of_int c.minor_time_total;
+  "minor_time_peak_ns", string_of_int c.minor_time_peak;
+  "major_time_total_ns", string_of_int c.major_time_total;
+  "major_time_peak_ns", string_of_int c.major_time_peak;
+]
+
+let json_of_domain_stats d =
+  json_of_fields (
+    ("domain_id", string_of_int d.domain_id)
+    :: ("pools", json_of_pool_counts d.domain_pools)
+    :: counters_fields d.domain_counters)
+
+let json_of_scan_percentiles ~major =
+  json_of_fields (List.map (fun (k, p) ->
+      k, string_of_int (scan_percentile ~major p))
+      ["p50", 50.; "p99", 99.; "p99.9", 99.9])
+
+let json_of_stats s =
+  json_of_fields (counters_fields s.counters @ [
+    "major_slices", string_of_int s.major_slices;
+    "alloced_pools", string_of_int s.alloced_pools;
+    "emptied_pools", string_of_int s.emptied_pools;
+    "freed_pools", string_of_int s.freed_pools;
+    "live_pools", string_of_int s.live_pools;
+    "peak_pools", string_of_int s.peak_pools;
+    "pools", json_of_pool_counts s.pools;
+    "domains", Printf.sprintf "[%s]" (String.concat ", "
+      (Array.to_list (Array.map json_of_domain_stats s.domains)));
+    "minor_scan_ns", json_of_scan_percentiles ~major:false;
+    "major_scan_ns", json_of_scan_percentiles ~major:true;
+  ])
+
+(* STATS=json: one JSON object on a line *)
+let print_stats () =
+  match Sys.getenv "STATS" with
+  | "json" -> print_endline (json_of_stats (get_stats ()))
+  | _ -> print_stats_text ()
+  | exception Not_found -> print_stats_text ()
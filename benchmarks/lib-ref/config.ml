@@ -43,11 +43,11 @@ let implem_name, implem_module =
 let show_stats =
   match Sys.getenv "STATS" with
   | exception _ -> false
-  | "1" | "true" | "yes" -> true
+  | "1" | "true" | "yes" | "json" -> true
   | "0" | "false" | "no" -> false
   | other ->
     Printf.eprintf "Unknown value %S for the environment variable STATS.\n\
-                    Expected 'true' or 'false'.\n%!" other;
+                    Expected 'true', 'false' or 'json'.\n%!" other;
     false
 
 module Ref = struct
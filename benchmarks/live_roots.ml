@@ -0,0 +1,82 @@
+(* SPDX-License-Identifier: MIT *)
+module Ref_config = Ref.Config
+module Ref = Ref_config.Ref
+
+(* Time spent in collections while a large number of roots is alive,
+   to measure the cost of root scanning.
+
+REF=boxroot N=10_000_000 GCS=20 VALUES=block ./benchmarks/live_roots.exe
+
+   N: number of live roots
+   GCS: number of minor and major collections to measure, and number
+        of major cycles over which major slices are measured
+   VALUES: 'block' for roots to distinct blocks in the major heap,
+           'int' for immediate values (measures the traversal of the
+           roots alone).
+*)
+
+let get_param reader param default =
+  match Sys.getenv param with
+  | exception Not_found -> default
+  | s ->
+    try reader s
+    with _ -> Printf.ksprintf failwith "Invalid environment variable %s=%s" param s
+
+let n = get_param int_of_string "N" 1_000_000
+
+let gcs = get_param int_of_string "GCS" 20
+
+let blocks = get_param (function
+    | "block" -> true
+    | "int" -> false
+    | _ -> raise Exit) "VALUES" true
+
+let measure f =
+  let total = ref 0. and peak = ref 0. in
+  for _i = 1 to gcs do
+    (* Make sure that the minor heap is not empty *)
+    ignore (Sys.opaque_identity (ref 0));
+    let start = Sys.time () in
+    f ();
+    let t = Sys.time () -. start in
+    total := !total +. t;
+    if t > !peak then peak := t
+  done;
+  !total /. float gcs, !peak
+
+(* Peak time of the major slices of [gcs] major cycles. Roots are
+   scanned during the first slice of each cycle, which determines the
+   pause time. *)
+let measure_slices () =
+  let peak = ref 0. and slices = ref 0 in
+  let cycles () = (Gc.quick_stat ()).Gc.major_collections in
+  let target = cycles () + gcs in
+  while cycles () < target do
+    ignore (Sys.opaque_identity (ref 0));
+    let start = Sys.time () in
+    ignore (Gc.major_slice 0);
+    let t = Sys.time () -. start in
+    incr slices;
+    if t > !peak then peak := t
+  done;
+  !peak, !slices
+
+let () =
+  Ref.setup ();
+  Printf.printf "%s: %!" Ref_config.implem_name;
+  let roots = Array.init n (fun i -> Ref.create (if blocks then Obj.repr (ref i) else Obj.repr i)) in
+  Gc.full_major ();
+  let minor_avg, minor_peak = measure Gc.minor in
+  let major_avg, major_peak = measure Gc.major in
+  let slice_peak, slices = measure_slices () in
+  Printf.printf "%.2fs (minor: %.3fms avg, %.3fms peak; \
+                 major: %.3fms avg, %.3fms peak; \
+                 major slice: %.3fms peak over %d slices)\n%!"
+    (Sys.time ())
+    (minor_avg *. 1000.) (minor_peak *. 1000.)
+    (major_avg *. 1000.) (major_peak *. 1000.)
+    (slice_peak *. 1000.) slices;
+  if Ref_config.show_stats then
+    Ref.print_stats ();
+  Array.iter Ref.delete roots;
+  Ref.teardown ()
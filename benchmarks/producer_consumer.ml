@@ -0,0 +1,118 @@
+(* SPDX-License-Identifier: MIT *)
+module Ref_config = Ref.Config
+module Ref = Ref_config.Ref
+
+(* OCaml 5 only. Two-domain pipeline: the main domain creates N roots
+   for messages and sends them in batches of BATCH to a consumer
+   domain, which reads and deletes them. With REPLY=1, the consumer
+   also creates a root for each message, sent back to the producer
+   which deletes it.
+
+   With boxroot, every deletion is remote, unless the pools are handed
+   over to the consumer (BOXROOT_HANDOFF).
+
+REF=boxroot N=10_000_000 BATCH=1_000 REPLY=0 ./benchmarks/producer_consumer.exe
+*)
+
+let get_param reader param default =
+  match Sys.getenv param with
+  | exception Not_found -> default
+  | s ->
+    try reader s
+    with _ -> Printf.ksprintf failwith "Invalid environment variable %s=%s" param s
+
+let n = get_param int_of_string "N" 10_000_000
+
+let batch = get_param int_of_string "BATCH" 1_000
+
+let reply = get_param (function
+    | "1" | "true" | "yes" -> true
+    | "0" | "false" | "no" -> false
+    | _ -> raise Exit) "REPLY" false
+
+(* Channel of batches, holding at most [max_queued] batches. [None]
+   tells the receiver to stop. *)
+type 'a channel = {
+  queue : 'a option Queue.t;
+  max_queued : int;
+  lock : Mutex.t;
+  nonempty : Condition.t;
+  nonfull : Condition.t;
+}
+
+let channel max_queued = {
+  queue = Queue.create ();
+  max_queued;
+  lock = Mutex.create ();
+  nonempty = Condition.create ();
+  nonfull = Condition.create ();
+}
+
+let send c b =
+  Mutex.lock c.lock;
+  while Queue.length c.queue >= c.max_queued do Condition.wait c.nonfull c.lock done;
+  Queue.push b c.queue;
+  Condition.signal c.nonempty;
+  Mutex.unlock c.lock
+
+let receive c =
+  Mutex.lock c.lock;
+  while Queue.is_empty c.queue do Condition.wait c.nonempty c.lock done;
+  let b = Queue.pop c.queue in
+  Condition.signal c.nonfull;
+  Mutex.unlock c.lock;
+  b
+
+let messages = channel 16
+(* Unbounded: the producer only receives replies between two batches *)
+let replies = channel max_int
+
+let consumer () =
+  let rec loop sum =
+    match receive messages with
+    | None -> if reply then send replies None; sum
+    | Some roots ->
+      let sum = Array.fold_left (fun sum r ->
+          let x = !(Ref.get r) in
+          Ref.delete r;
+          sum + x) sum roots in
+      if reply then
+        send replies (Some (Array.init (Array.length roots)
+                              (fun i -> Ref.create (ref i))));
+      loop sum
+  in
+  loop 0
+
+(* The producer deletes the replies between two batches *)
+let rec delete_replies ~wait =
+  let ready =
+    wait || begin
+      Mutex.lock replies.lock;
+      let ready = not (Queue.is_empty replies.queue) in
+      Mutex.unlock replies.lock;
+      ready
+    end
+  in
+  if ready then
+    match receive replies with
+    | None -> ()
+    | Some roots -> Array.iter Ref.delete roots; delete_replies ~wait
+
+let () =
+  Ref.setup ();
+  Printf.printf "%s (reply: %b): %!" Ref_config.implem_name reply;
+  let start_time = Unix.gettimeofday () in
+  let d = Domain.spawn consumer in
+  for b = 0 to n / batch - 1 do
+    send messages (Some (Array.init batch (fun i -> Ref.create (ref (b + i)))));
+    if reply then delete_replies ~wait:false
+  done;
+  send messages None;
+  if reply then delete_replies ~wait:true;
+  let sum = Domain.join d in
+  ignore (Sys.opaque_identity sum);
+  let elapsed = Unix.gettimeofday () -. start_time in
+  Printf.printf "%.2fs (%.2fM messages/s)\n%!" elapsed (float n /. elapsed /. 1e6);
+  if Ref_config.show_stats then
+    Ref.print_stats ();
+  Ref.teardown ()
@@ -0,0 +1,112 @@
+(* SPDX-License-Identifier: MIT *)
+module Boxroot_ref = Ref.Boxroot_ref
+
+(* OCaml 5 only, boxroot only. Remote deallocations: the main domain
+   creates N roots in batches of BATCH and hands them over to WORKERS
+   deleters, which delete them while the main domain keeps allocating
+   roots. Reports the deletion throughput and the latency of
+   individual deletions.
+
+   MODE: 'domains' for deleters running in other domains,
+         'threads' for systhreads of the main domain that delete
+         without holding the runtime lock.
+
+MODE=domains WORKERS=4 N=1_000_000 BATCH=1_000 ./benchmarks/remote_delete.exe
+*)
+
+let get_param reader param default =
+  match Sys.getenv param with
+  | exception Not_found -> default
+  | s ->
+    try reader s
+    with _ -> Printf.ksprintf failwith "Invalid environment variable %s=%s" param s
+
+let use_domains = get_param (function
+    | "domains" -> true
+    | "threads" -> false
+    | _ -> raise Exit) "MODE" true
+
+let workers = get_param int_of_string "WORKERS" 4
+
+let n = get_param int_of_string "N" 1_000_000
+
+let batch = get_param int_of_string "BATCH" 1_000
+
+let show_stats = get_param (function
+    | "1" | "true" | "yes" | "json" -> true
+    | "0" | "false" | "no" -> false
+    | _ -> raise Exit) "STATS" false
+
+external delete_batch : 'a Boxroot_ref.t array -> Float.Array.t -> bool -> unit
+  = "remote_delete_batch"
+
+(* Bounded queue of batches, so that creations and deletions
+   overlap. [None] tells a deleter to stop. *)
+let queue = Queue.create ()
+let max_queued = 16
+let lock = Mutex.create ()
+let nonempty = Condition.create ()
+let nonfull = Condition.create ()
+
+let push b =
+  Mutex.lock lock;
+  while Queue.length queue >= max_queued do Condition.wait nonfull lock done;
+  Queue.push b queue;
+  Condition.signal nonempty;
+  Mutex.unlock lock
+
+let pop () =
+  Mutex.lock lock;
+  while Queue.is_empty queue do Condition.wait nonempty lock done;
+  let b = Queue.pop queue in
+  Condition.signal nonfull;
+  Mutex.unlock lock;
+  b
+
+let deleter () =
+  let rec loop acc =
+    match pop () with
+    | None -> acc
+    | Some roots ->
+      let times = Float.Array.create (Array.length roots) in
+      delete_batch roots times (not use_domains);
+      loop (times :: acc)
+  in
+  loop []
+
+let percentile sorted p =
+  let len = Float.Array.length sorted in
+  Float.Array.get sorted (min (len - 1) (int_of_float (p *. float len)))
+
+let () =
+  Boxroot_ref.setup ();
+  Printf.printf "boxroot (%d %s): %!" workers
+    (if use_domains then "domains" else "threads");
+  let start_time = Unix.gettimeofday () in
+  let join =
+    if use_domains then begin
+      let ds = List.init workers (fun _ -> Domain.spawn deleter) in
+      fun () -> List.concat_map Domain.join ds
+    end else begin
+      let results = Array.make workers [] in
+      let ts = List.init workers (fun i ->
+          Thread.create (fun () -> results.(i) <- deleter ()) ()) in
+      fun () -> List.iter Thread.join ts; List.concat (Array.to_list results)
+    end
+  in
+  for b = 0 to n / batch - 1 do
+    push (Some (Array.init batch (fun i -> Boxroot_ref.create (ref (b + i)))))
+  done;
+  for _i = 1 to workers do push None done;
+  let times = Float.Array.concat (join ()) in
+  let elapsed = Unix.gettimeofday () -. start_time in
+  Float.Array.sort Float.compare times;
+  let deleted = Float.Array.length times in
+  Printf.printf "%.2fs (%.2fM deletions/s; delete: %.0fns p50, %.0fns p99, \
+                 %.0fns max)\n%!"
+    elapsed (float deleted /. elapsed /. 1e6)
+    (percentile times 0.5 *. 1e9) (percentile times 0.99 *. 1e9)
+    (percentile times 1. *. 1e9);
+  if show_stats then
+    Boxroot_ref.print_stats ();
+  Boxroot_ref.teardown ()
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: MIT */
+#define CAML_NAME_SPACE
+#include <caml/mlvalues.h>
+#include <caml/memory.h>
+#include <caml/fail.h>
+#include <caml/signals.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../boxroot/boxroot.h"
+
+/* Representation of Boxroot_ref.t (see lib-ref/gen_boxroot.h) */
+#define Boxroot_val(r) ((boxroot)((r) & ~((value)1)))
+
+static double now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/* Delete the boxroots of the array [roots], and store the time taken
+   by each deletion in the float array [times]. If [release] is true,
+   the deletions happen without holding the runtime lock. */
+value remote_delete_batch(value roots, value times, value release)
+{
+  CAMLparam3(roots, times, release);
+  mlsize_t n = Wosize_val(roots);
+  boxroot *b = malloc(n * sizeof(boxroot));
+  double *t = malloc(n * sizeof(double));
+  if (b == NULL || t == NULL) {
+    free(b);
+    free(t);
+    caml_raise_out_of_memory();
+  }
+  for (mlsize_t i = 0; i < n; i++) b[i] = Boxroot_val(Field(roots, i));
+  if (Bool_val(release)) caml_enter_blocking_section();
+  for (mlsize_t i = 0; i < n; i++) {
+    double start = now();
+    boxroot_delete(b[i]);
+    t[i] = now() - start;
+  }
+  if (Bool_val(release)) caml_leave_blocking_section();
+  for (mlsize_t i = 0; i < n; i++) Store_double_flat_field(times, i, t[i]);
+  free(b);
+  free(t);
+  CAMLreturn(Val_unit);
+}
@@ -0,0 +1,61 @@
+(* SPDX-License-Identifier: MIT *)
+module Ref_config = Ref.Config
+module Ref = Ref_config.Ref
+
+(* OCaml 5 only. Minor pause times when one domain owns all the
+   roots: the main domain holds N young roots at each minor
+   collection, while DOMAINS - 1 other domains only allocate (and
+   thus take part in the minor collections).
+
+REF=boxroot N=1_000_000 DOMAINS=4 GCS=100 ./benchmarks/skewed_domains.exe
+*)
+
+let get_param reader param default =
+  match Sys.getenv param with
+  | exception Not_found -> default
+  | s ->
+    try reader s
+    with _ -> Printf.ksprintf failwith "Invalid environment variable %s=%s" param s
+
+let n = get_param int_of_string "N" 1_000_000
+
+let domains = get_param int_of_string "DOMAINS" 4
+
+let gcs = get_param int_of_string "GCS" 100
+
+let () =
+  (* Large enough to hold the young values of all roots *)
+  Gc.set { (Gc.get ()) with Gc.minor_heap_size = 4 * n };
+  Ref.setup ();
+  Printf.printf "%s: %!" Ref_config.implem_name;
+  let stop = Atomic.make false in
+  let idle () =
+    while not (Atomic.get stop) do
+      ignore (Sys.opaque_identity (ref 0))
+    done
+  in
+  let others = List.init (domains - 1) (fun _ -> Domain.spawn idle) in
+  let roots = Array.init n (fun i -> Ref.create (ref i)) in
+  let total = ref 0. and peak = ref 0. in
+  let start_time = Unix.gettimeofday () in
+  for _gc = 1 to gcs do
+    (* Replace the roots with young values *)
+    for i = 0 to n - 1 do
+      Ref.delete roots.(i);
+      roots.(i) <- Ref.create (ref i)
+    done;
+    let start = Unix.gettimeofday () in
+    Gc.minor ();
+    let t = Unix.gettimeofday () -. start in
+    total := !total +. t;
+    if t > !peak then peak := t
+  done;
+  Atomic.set stop true;
+  List.iter Domain.join others;
+  Printf.printf "%.2fs (minor: %.3fms avg, %.3fms peak)\n%!"
+    (Unix.gettimeofday () -. start_time)
+    (!total /. float gcs *. 1000.) (!peak *. 1000.);
+  if Ref_config.show_stats then
+    Ref.print_stats ();
+  Array.iter Ref.delete roots;
+  Ref.teardown ()
@@ -1,5 +1,6 @@
 (* SPDX-License-Identifier: MIT *)
 module Ref_config = Ref.Config
+module Domains = Ref.Domains
 module Ref = Ref_config.Ref
 
 (* a synthetic benchmark with tunable parameters.
@@ -15,6 +16,8 @@ GC_PROMOTION_RATE=0.1 \
 GC_SURVIVAL_RATE=0.5 \
 ./benchmarks/synthetic.exe
 
+With DOMAINS=n (OCaml 5), the benchmark is run in n domains at once.
+The time is the total CPU time.
 *)
 
 let wrong_usage () =
@@ -243,10 +246,15 @@ let n =
   with _ ->
     Printf.ksprintf failwith "We expected an environment variable N with an integer value."
 
+let domains =
+  try int_of_string (Sys.getenv "DOMAINS")
+  with Not_found -> 1
+
 let () =
   Ref.setup ();
-  Printf.printf "%s: %!" Ref_config.implem_name;
-  run n;
+  if domains = 1 then Printf.printf "%s: %!" Ref_config.implem_name
+  else Printf.printf "%s (%d domains): %!" Ref_config.implem_name domains;
+  ignore (Domains.run domains (fun _ -> run n));
   Printf.printf "%.2fs\n%!" (Sys.time ());
   if Ref_config.show_stats then
     Ref.print_stats ();
@@ -33,9 +33,26 @@ inline value const * boxroot_get_ref(boxroot r) { return (value *)r; }
 /* `boxroot_delete(r)` deallocates the boxroot `r`. The value is no
    longer considered as a root by the OCaml GC. The argument must be
    non-null. (One does not need to hold the OCaml domain lock before
-   calling `boxroot_delete`.)*/
+   calling `boxroot_delete`.)
+
+   A deallocation by a thread that does not hold the lock of the
+   domain that allocated `r` is completed by that domain at its next
+   collection. If boxroot is built with `BOXROOT_REMOTE_BUFFER=n` for
+   n > 0, such deallocations are instead buffered by the calling
+   thread, and the value is still considered as a root until the
+   buffer is flushed. Only the calling thread flushes its buffer: when
+   it is full, at its first such deallocation after a collection, when
+   it terminates, and by `boxroot_flush_releases`. A thread that
+   deallocates a few boxroots and then stays idle keeps their values
+   alive in the meantime. */
 inline void boxroot_delete(boxroot);
 
+/* `boxroot_flush_releases()` completes the deallocations buffered by
+   the current thread (see `boxroot_delete`), and does nothing if
+   deallocations are not buffered. One does not need to hold the OCaml
+   domain lock before calling it. */
+void boxroot_flush_releases();
+
 /* `boxroot_modify(&r,v)` changes the value kept alive by the boxroot
    `r` to `v`. It is equivalent to the following:
    ```
@@ -52,6 +69,23 @@ inline void boxroot_delete(boxroot);
 */
 void boxroot_modify(boxroot *, value);
 
+/* `boxroot_migrate(&r)` moves the boxroot `r` to the pools of the
+   current domain, when it has been allocated by another domain.
+   Deleting and modifying a boxroot is faster from the domain that
+   allocated it: this is useful when a long-lived boxroot is handed
+   over to another domain. It is equivalent to the following:
+   ```
+   boxroot r2 = boxroot_create(boxroot_get(r));
+   boxroot_delete(r);
+   r = r2;
+   ```
+   A return value of 0 indicates a failure of allocation, in which
+   case `r` is left unchanged.
+
+   The OCaml domain lock must be held before calling
+   `boxroot_migrate`. */
+int boxroot_migrate(boxroot *);
+
 
 /* `boxroot_teardown()` releases all the resources of Boxroot. None of
    the function above must be called after this. `boxroot_teardown`
@@ -61,6 +95,139 @@ void boxroot_teardown();
 /* Show some statistics on the standard output. */
 void boxroot_print_stats();
 
+/* Statistics as structured values. The structures can grow in later
+   versions: the caller passes the size of the structure it knows,
+   and only this many bytes are written. The first field is always
+   the version of the structure that was filled. */
+#define BOXROOT_STATS_VERSION 2
+
+/* Number of pools in the rings of a domain */
+struct boxroot_pool_counts {
+  /* Pools of young values, including the current pool */
+  long long young;
+  /* Pools of old values */
+  long long old;
+  /* Empty pools, kept until the next major scanning */
+  long long free;
+};
+
+struct boxroot_stats {
+  int version;
+  /* Number of domain ids, for `boxroot_get_domain_stats` */
+  int num_domains;
+  long long minor_collections;
+  long long major_collections;
+  long long major_slices;
+  long long create_slow;
+  long long delete_slow;
+  long long remote_flushes;
+  long long handoffs;
+  /* Number of slots visited while scanning */
+  long long scanning_work_minor;
+  long long scanning_work_major;
+  /* Time spent scanning, in nanoseconds (0 without a monotonic
+     clock) */
+  long long minor_time_total;
+  long long minor_time_peak;
+  long long major_time_total;
+  long long major_time_peak;
+  long long alloced_pools;
+  long long emptied_pools;
+  long long freed_pools;
+  long long live_pools;
+  long long peak_pools;
+  /* Sum over all domains, including the pools of terminated domains
+     not yet adopted */
+  struct boxroot_pool_counts pools;
+};
+
+struct boxroot_domain_stats {
+  int version;
+  int domain_id;
+  struct boxroot_pool_counts pools;
+  /* Since version 2: the counters of `struct boxroot_stats` for the
+     threads holding the lock of the domain. */
+  long long minor_collections;
+  long long major_collections;
+  long long create_slow;
+  long long delete_slow;
+  long long remote_flushes;
+  long long handoffs;
+  long long scanning_work_minor;
+  long long scanning_work_major;
+  long long minor_time_total;
+  long long minor_time_peak;
+  long long major_time_total;
+  long long major_time_peak;
+};
+
+/* `boxroot_get_stats(out, sizeof(*out))` fills `out` with
+   statistics aggregated over all domains. Returns the number of bytes
+   written. One does not need to hold the OCaml domain lock before
+   calling it. */
+size_t boxroot_get_stats(struct boxroot_stats *out, size_t size);
+
+/* `boxroot_get_domain_stats(id, out, sizeof(*out))` fills `out` with
+   the statistics of the domain `id`, between 0 and
+   `num_domains - 1`. Counters updated by threads that do not belong
+   to a domain (with OCaml 5) or that do not hold the runtime lock
+   (with OCaml 4) appear only in the aggregated statistics. Returns
+   the number of bytes written, or 0 if the domain has never
+   allocated a boxroot. One does not need to hold the OCaml domain
+   lock before calling it. */
+size_t boxroot_get_domain_stats(int domain_id,
+                                struct boxroot_domain_stats *out,
+                                size_t size);
+
+/* `boxroot_reset_stats()` resets the counters, the totals and the
+   peaks, so that the following statistics cover a new window of
+   time. The number of live pools is kept. */
+void boxroot_reset_stats();
+
+/* Histograms of the durations of the scanning of roots by each
+   domain at the start of collections, by kind of collection and by
+   number of pools scanned. The durations are bucketed
+   log-linearly: each power of two is split into 4 buckets. */
+#define BOXROOT_SCAN_HIST_BUCKETS 97
+#define BOXROOT_SCAN_HIST_POOL_CLASSES 7
+enum { BOXROOT_SCAN_MINOR, BOXROOT_SCAN_MAJOR };
+
+struct boxroot_scan_histogram {
+  int version;
+  /* -1 for all domains */
+  int domain_id;
+  /* `counts[kind][c][b]` is the number of scannings of kind `kind`
+     of between `boxroot_scan_histogram_pools(c)` and
+     `boxroot_scan_histogram_pools(c+1) - 1` pools, that lasted
+     between `boxroot_scan_histogram_ns(b)` and
+     `boxroot_scan_histogram_ns(b+1) - 1` nanoseconds. */
+  long long counts[2][BOXROOT_SCAN_HIST_POOL_CLASSES]
+                  [BOXROOT_SCAN_HIST_BUCKETS];
+};
+
+/* `boxroot_get_scan_histogram(id, out, sizeof(*out))` fills `out`
+   with the histogram of the domain `id`, or of all domains if `id` is
+   -1. Returns the number of bytes written, or 0 if `id` is invalid.
+   One does not need to hold the OCaml domain lock before calling
+   it. Reset by `boxroot_reset_stats`. */
+size_t boxroot_get_scan_histogram(int domain_id,
+                                  struct boxroot_scan_histogram *out,
+                                  size_t size);
+
+/* Lower bound of the bucket `b` of durations, in nanoseconds, and of
+   the class `c` of pool counts. The bounds of the bucket and of the
+   class after the last are `LLONG_MAX`. */
+long long boxroot_scan_histogram_ns(int b);
+long long boxroot_scan_histogram_pools(int c);
+
+/* `boxroot_scan_histogram_percentile(h, kind, p)` returns the upper
+   bound, in nanoseconds, of the bucket containing the `p`-th
+   percentile (between 0 and 100) of the durations of kind `kind`,
+   for any number of pools. Returns 0 if there is none. */
+long long
+boxroot_scan_histogram_percentile(const struct boxroot_scan_histogram *h,
+                                  int kind, double p);
+
 
 /* Obsolete, does nothing. */
 
@@ -88,9 +255,12 @@ boxroot boxroot_create_slow(value v);
 /* Test the overheads of multithreading (systhreads and multicore).
    Purely for experimental purposes. Otherwise should always be 1. */
 #define BOXROOT_MULTITHREAD 1
-/* Make every deallocation a remote deallocation. For testing purposes
-   only. Otherwise should always be 0. */
+/* Make every deallocation a remote deallocation. For testing and
+   benchmarking purposes only (set in dune). Otherwise should always
+   be 0. */
+#ifndef BOXROOT_FORCE_REMOTE
 #define BOXROOT_FORCE_REMOTE 0
+#endif
 
 inline boxroot boxroot_create(value init)
 {
@@ -114,10 +284,10 @@ slow:
    Recommended: 14. */
 #define POOL_LOG_SIZE 14
 #define POOL_SIZE ((size_t)1 << POOL_LOG_SIZE)
-/* Every DEALLOC_THRESHOLD deallocations, make a pool available for
-   allocation or demotion into a young pool, or reclassify it as an
-   empty pool if empty. Change this with benchmarks in hand. Must be a
-   power of 2. */
+/* Every DEALLOC_THRESHOLD deallocations, move a pool to the bucket of
+   its new occupancy (see boxroot.c), or reclassify it as an empty
+   pool if empty. Change this with benchmarks in hand. Must be a power
+   of 2. */
 #define DEALLOC_THRESHOLD ((int)POOL_SIZE / 2)
 
 #define Get_pool_header(s)                                \
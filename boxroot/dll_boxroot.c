@@ -6,9 +6,6 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
-#if defined(ENABLE_BOXROOT_MUTEX) && (ENABLE_BOXROOT_MUTEX == 1)
-#include <pthread.h>
-#endif
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -16,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdatomic.h>
 
 #define CAML_NAME_SPACE
 #define CAML_INTERNALS
@@ -23,6 +21,7 @@
 #include "dll_boxroot.h"
 #include <caml/minor_gc.h>
 #include <caml/major_gc.h>
+#include <caml/domain_state.h>
 
 #if defined(_POSIX_TIMERS) && defined(_POSIX_MONOTONIC_CLOCK)
 #define POSIX_CLOCK
@@ -32,12 +31,39 @@
 #include "ocaml_hooks.h"
 #include "platform.h"
 
+#define LIKELY(a) BOXROOT_LIKELY(a)
+#define UNLIKELY(a) BOXROOT_UNLIKELY(a)
+
+/* }}} */
+
+/* {{{ Parameters */
+
+/* Log of the size of the slabs (2^14 = 16KiB) */
+#define SLAB_LOG_SIZE 14
+#define SLAB_SIZE ((size_t)1 << SLAB_LOG_SIZE)
+
 /* }}} */
 
 /* {{{ Data types */
 
-// values are stored in "ring elements"
-// rings: cyclic doubly-linked lists
+/* Values are stored in "ring elements". Rings are cyclic
+   doubly-linked lists. Each domain has a ring of elements with young
+   values, the only ones scanned at minor collections, and a ring of
+   elements with old values.
+
+   Elements are allocated in "slabs" on aligned addresses, which
+   amortizes malloc() calls and gives us a fast way to get the slab of
+   an element on deletion. Free elements are in no ring: they form the
+   free list of their slab, linked by their [next] field.
+
+   Each slab is owned by a domain, whose rings contain the elements
+   allocated in the slab. The rings of a domain are protected by its
+   domain lock. Other domains and threads never unlink the elements
+   they deallocate: remote deallocations are recorded in
+   [remote_freed], and the owner takes the elements out of its rings
+   later.
+*/
+
 struct elem {
   value slot;
   struct elem *prev;
@@ -46,40 +72,129 @@ struct elem {
 
 typedef struct elem *ring;
 
+#define REMOTE_BITS ((int)(8 * sizeof(uintptr_t)))
+#define REMOTE_WORDS                                                    \
+  ((int)((SLAB_SIZE / sizeof(struct elem) + REMOTE_BITS - 1) / REMOTE_BITS))
+
+typedef enum class {
+  /* In the ring of slabs available for allocation */
+  AVAILABLE,
+  /* In the ring of slabs found to be full */
+  FULL,
+  /* In no ring: about to be freed */
+  UNTRACKED
+} class;
+
+struct header {
+  /* protected by domain lock of domain_id */
+  struct elem *free_list; /* NULL-terminated */
+  int alloc_count;
+  /* protected by domain lock of domain_id, kept in sync with its
+     location in the slab rings */
+  class class;
+  struct slab *prev;
+  struct slab *next;
+  /* Set by a remote modification that could not reallocate its
+     element (see remote_modify). Protected by the rings lock of
+     domain_id. */
+  int pinned;
+#if OCAML_MULTICORE
+  /* Owner. Written by the owner with the orphaned rings lock held. */
+  atomic_int domain_id;
+#endif
+  /* Whether the slab is in the list of pending slabs of its owner,
+     and next slab in this list. Set by remote deallocations, reset by
+     the owner when it takes the slab out of the list. */
+  atomic_int pending;
+  struct slab *pending_next;
+  /* Elements deallocated by threads that do not hold the lock of the
+     owning domain, one bit per element. Set without locking, taken by
+     the owner in [gc_slab]. */
+  atomic_uintptr_t remote_freed[REMOTE_WORDS];
+};
+
+#define SLAB_CAPACITY                                           \
+  ((int)((SLAB_SIZE - sizeof(struct header)) / sizeof(struct elem)))
+
+typedef struct slab {
+  struct header hd;
+  struct elem elems[SLAB_CAPACITY];
+} slab;
+
+static_assert(sizeof(slab) <= SLAB_SIZE, "bad slab size");
+
 /* }}} */
 
 /* {{{ Globals */
 
-/* Global rings. */
-static struct {
+/* Per-domain rings. */
+typedef struct {
+  /* This mutex synchronises:
+     - the scanning of the elements by their owner with their
+       modification by other domains (see remote_modify),
+     - the access to the orphaned rings.
+     The rings of a running domain are otherwise protected by its
+     domain lock. */
+  mutex_t mutex;
   /* list of elements with young values */
   ring young;
-
   /* list of elements with old values */
   ring old;
+  /* Ring of slabs available for allocation. The first one is the
+     current slab. */
+  slab *slabs;
+  /* On-the-side ring of slabs that were found to be full by
+     find_available_slab(). */
+  slab *full_slabs;
+  /* List of slabs with remote deallocations, linked by
+     [pending_next]. Lock-free stack: pushed by remote deallocations,
+     taken as a whole by the domain (see gc_pending_slabs). */
+  _Atomic(slab *) pending;
+  /* Number of remote deallocations in progress that record slabs as
+     pending in this domain (see wait_remote_deallocations). */
+  atomic_int pushers;
+} domain_rings;
 
-  /* list of empty elements */
-  ring free;
-} rings;
-
-static void validate_all_rings();
-
-struct stats {
-  int minor_collections;
-  int major_collections;
-  int total_create;
-  int total_delete;
-  int total_modify;
-  long long total_scanning_work_minor;
-  long long total_scanning_work_major;
-  int64_t total_minor_time;
-  int64_t total_major_time;
-  int64_t peak_minor_time;
-  int64_t peak_major_time;
-  long long is_young; // count 'is_young_block' checks
-};
+/* Constant once allocated. */
+static domain_rings *rings[Num_domains + 1] = { NULL };
+#define Orphaned_id Num_domains
 
-static struct stats stats;
+/* Whether the orphaned rings might be non-empty. Lets domains skip
+   locking the orphaned rings in the common case. Written with the
+   orphaned rings lock held. */
+#if OCAML_MULTICORE
+static atomic_int orphans_available = 0;
+#define get_orphans_available()                                         \
+  atomic_load_explicit(&orphans_available, memory_order_acquire)
+#define set_orphans_available(b)                                        \
+  atomic_store_explicit(&orphans_available, (b), memory_order_release)
+#else
+static int orphans_available = 0;
+#define get_orphans_available() orphans_available
+#define set_orphans_available(b) (orphans_available = (b))
+#endif
+
+static struct {
+  stat_t minor_collections;
+  stat_t major_collections;
+  stat_t total_create;
+  stat_t total_delete;
+  stat_t total_modify;
+  stat_t total_remote_free;
+  stat_t total_remote_realloc; // remote modifications that reallocated
+  stat_t total_scanning_work_minor;
+  stat_t total_scanning_work_major;
+  stat_t total_minor_time;
+  stat_t total_major_time;
+  stat_t peak_minor_time;
+  stat_t peak_major_time;
+  stat_t total_alloced_slabs;
+  stat_t total_freed_slabs;
+  stat_t total_orphaned_slabs;
+  stat_t live_slabs; // number of tracked slabs
+  stat_t peak_slabs; // max live slabs at any time
+  stat_t is_young; // count 'is_young_block' checks
+} stats;
 
 /* }}} */
 
@@ -135,65 +250,482 @@ static ring ring_pop(ring *target)
   return front;
 }
 
-static ring ring_pop_elem(ring elem)
+// remove [elem] from the ring of [local] that contains it
+static ring ring_pop_elem(domain_rings *local, ring elem)
 {
   ring prev = ring_pop(&elem);
-  if (rings.young == prev) rings.young = elem;
-  if (rings.old == prev) rings.old = elem;
+  if (local->young == prev) local->young = elem;
+  if (local->old == prev) local->old = elem;
   return prev;
 }
 
-void free_ring(ring r) {
-  if (r == NULL) return;
-  struct elem *cur = r;
-  do {
-    struct elem *next = cur->next;
-    free(cur);
-    cur = next;
-  } while (cur != r);
+static void slab_ring_link(slab *p, slab *q)
+{
+  p->hd.next = q;
+  q->hd.prev = p;
 }
+
+// insert the ring [source] at the back of [*target].
+static void slab_ring_push_back(slab *source, slab **target)
+{
+  if (source == NULL) return;
+  if (*target == NULL) {
+    *target = source;
+  } else {
+    slab *target_last = (*target)->hd.prev;
+    slab *source_last = source->hd.prev;
+    slab_ring_link(target_last, source);
+    slab_ring_link(source_last, *target);
+  }
+}
+
+// remove the first slab from [*target] and return it
+static slab * slab_ring_pop(slab **target)
+{
+  slab *front = *target;
+  assert(front);
+  if (front->hd.next == front) {
+    *target = NULL;
+    return front;
+  }
+  slab_ring_link(front->hd.prev, front->hd.next);
+  *target = front->hd.next;
+  slab_ring_link(front, front);
+  return front;
+}
+
 /* }}} */
 
-/* {{{ Ring of free elements */
+/* {{{ Slab ownership */
 
-ring create_elem() {
-  if (rings.free != NULL) {
-    return ring_pop(&rings.free);
+static inline slab * get_slab(struct elem *elem)
+{
+  return (slab *)((uintptr_t)elem & ~((uintptr_t)SLAB_SIZE - 1));
+}
+
+/* requires domain lock: NO
+   requires rings lock: NO */
+static inline int dom_id_of_slab(slab *s)
+{
+#if OCAML_MULTICORE
+  return atomic_load_explicit(&s->hd.domain_id, memory_order_relaxed);
+#else
+  (void)s;
+  return 0;
+#endif
+}
+
+/* requires domain lock: NO
+   requires rings lock: NO */
+static inline void slab_set_dom_id(slab *s, int dom_id)
+{
+#if OCAML_MULTICORE
+  atomic_store_explicit(&s->hd.domain_id, dom_id, memory_order_relaxed);
+#else
+  (void)s;
+  (void)dom_id;
+#endif
+}
+
+/* requires domain lock: NO
+   requires rings lock: NO */
+static inline void acquire_rings(int dom_id)
+{
+  boxroot_mutex_lock(&rings[dom_id]->mutex);
+}
+
+/* requires domain lock: NO
+   requires rings lock: YES */
+static inline void release_rings(int dom_id)
+{
+  boxroot_mutex_unlock(&rings[dom_id]->mutex);
+}
+
+/* requires domain lock: NO
+   requires rings lock: NO */
+static int acquire_rings_of_slab(slab *s)
+{
+  int dom_id = dom_id_of_slab(s);
+  while (1) {
+    DEBUGassert(rings[dom_id] != NULL);
+    acquire_rings(dom_id);
+    int new_dom_id = dom_id_of_slab(s);
+    if (dom_id == new_dom_id) return dom_id;
+    /* Slab owner has changed before we could lock it. Try again. */
+    release_rings(dom_id);
+    dom_id = new_dom_id;
+  }
+}
+
+/* requires domain lock: NO
+   requires rings lock: NO */
+static domain_rings * alloc_domain_rings()
+{
+  domain_rings *dr = (domain_rings *)malloc(sizeof(domain_rings));
+  if (dr == NULL) goto out_err;
+  if (!boxroot_initialize_mutex(&dr->mutex)) goto out_err;
+  atomic_init(&dr->pending, NULL);
+  atomic_init(&dr->pushers, 0);
+  return dr;
+ out_err:
+  free(dr);
+  return NULL;
+}
+
+/* requires domain lock: YES
+   requires rings lock: NO */
+static domain_rings * init_domain_rings(int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  if (local == NULL) local = alloc_domain_rings();
+  if (local == NULL) return NULL;
+  local->young = NULL;
+  local->old = NULL;
+  local->slabs = NULL;
+  local->full_slabs = NULL;
+  /* The list of pending slabs has been handed over at orphaning */
+  rings[dom_id] = local;
+  return local;
+}
+
+/* }}} */
+
+/* {{{ Slab management */
+
+static inline int is_full_slab(slab *s)
+{
+  return s->hd.free_list == NULL;
+}
+
+static inline int is_empty_slab(slab *s)
+{
+  return s->hd.alloc_count == 0;
+}
+
+static inline int is_almost_full_slab(slab *s)
+{
+  return s->hd.alloc_count > SLAB_CAPACITY * 3 / 4;
+}
+
+static slab * get_empty_slab(int dom_id)
+{
+  long long live_slabs = incr(&stats.live_slabs);
+  if (live_slabs > stats.peak_slabs) stats.peak_slabs = live_slabs;
+
+  slab *s = (slab *)boxroot_alloc_uninitialised_pool(SLAB_SIZE);
+  if (s == NULL) return NULL;
+  incr(&stats.total_alloced_slabs);
+
+  slab_ring_link(s, s);
+  s->hd.free_list = NULL;
+  s->hd.alloc_count = 0;
+  s->hd.class = AVAILABLE;
+  s->hd.pinned = 0;
+#if OCAML_MULTICORE
+  atomic_init(&s->hd.domain_id, dom_id);
+#else
+  (void)dom_id;
+#endif
+  atomic_init(&s->hd.pending, 0);
+  s->hd.pending_next = NULL;
+  for (int i = 0; i < REMOTE_WORDS; i++) atomic_init(&s->hd.remote_freed[i], 0);
+
+  /* Put all the slab elements in its free list. */
+  for (struct elem *e = s->elems + SLAB_CAPACITY - 1; e >= s->elems; --e) {
+    e->slot = Val_unit;
+    e->next = s->hd.free_list;
+    s->hd.free_list = e;
   }
-  struct elem *elem = malloc(sizeof (struct elem));
-  if (elem == NULL) {
-    return NULL;
+
+  return s;
+}
+
+/* Find an available non-full slab or allocate a new one, ensure it is
+   at the start of the ring of slabs, and return it.
+
+   Full slabs encountered are moved to the full_slabs ring.
+
+   Returns NULL if none was found and the allocation of a new one
+   failed. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static slab * find_available_slab(int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  while (local->slabs != NULL && is_full_slab(local->slabs)) {
+    slab *s = slab_ring_pop(&local->slabs);
+    s->hd.class = FULL;
+    slab_ring_push_back(s, &local->full_slabs);
+  }
+  if (local->slabs == NULL) local->slabs = get_empty_slab(dom_id);
+  return local->slabs;
+}
+
+// remove the given slab from its slab ring
+/* requires domain lock: YES
+   requires rings lock: NO */
+static slab * slab_remove(slab *s, int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  slab *removed = slab_ring_pop(&s);
+  if (removed == local->slabs) local->slabs = s;
+  if (removed == local->full_slabs) local->full_slabs = s;
+  return removed;
+}
+
+/* Move a slab of the full-slab ring that has enough free elements
+   again back to the ring of available slabs. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void try_release_slab(slab *s, int dom_id)
+{
+  if (s->hd.class != FULL || is_almost_full_slab(s)) return;
+  slab *removed = slab_remove(s, dom_id);
+  removed->hd.class = AVAILABLE;
+  slab_ring_push_back(removed, &rings[dom_id]->slabs);
+}
+
+static void free_slab_ring(slab **target)
+{
+  while (*target != NULL) {
+    slab *s = slab_ring_pop(target);
+    boxroot_free_pool((pool *)s);
+    incr(&stats.total_freed_slabs);
+    decr(&stats.live_slabs);
   }
+}
+
+/* }}} */
+
+/* {{{ Ring of free elements */
+
+/* requires domain lock: YES
+   requires rings lock: NO */
+static ring alloc_elem(slab *s)
+{
+  struct elem *elem = s->hd.free_list;
+  s->hd.free_list = elem->next;
+  s->hd.alloc_count++;
   ring_link(elem, elem);
   return elem;
 }
 
-void delete_elem(ring elem) {
-  elem->slot = (value)NULL;
-  ring_push_back(elem, &rings.free);
+/* [elem] must have been removed from its ring. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void free_elem(slab *s, ring elem)
+{
+  elem->slot = Val_unit;
+  elem->next = s->hd.free_list;
+  s->hd.free_list = elem;
+  s->hd.alloc_count--;
+}
+
+/* }}} */
+
+/* {{{ Remote deallocation */
+
+static inline int lowest_bit(uintptr_t w)
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll(w);
+#else
+  int n = 0;
+  for (; !(w & 1); w >>= 1) n++;
+  return n;
+#endif
+}
+
+/* Take the elements deallocated remotely out of the rings of the
+   owner, and add them to the free list. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void gc_slab(slab *s, int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  for (int i = 0; i < REMOTE_WORDS; i++) {
+    atomic_uintptr_t *w = &s->hd.remote_freed[i];
+    if (0 == atomic_load_explicit(w, memory_order_relaxed)) continue;
+    uintptr_t bits = atomic_exchange(w, 0);
+    for (; bits != 0; bits &= bits - 1) {
+      struct elem *elem = &s->elems[i * REMOTE_BITS + lowest_bit(bits)];
+      free_elem(s, ring_pop_elem(local, elem));
+    }
+  }
+}
+
+/* Record that [s] has remote frees. [s->hd.pending] has been set by
+   the caller. */
+/* requires domain lock: NO
+   requires rings lock: NO */
+static void push_pending_slab(domain_rings *dr, slab *s)
+{
+  slab *head = atomic_load_explicit(&dr->pending, memory_order_relaxed);
+  do {
+    s->hd.pending_next = head;
+  } while (!atomic_compare_exchange_weak_explicit(&dr->pending, &head, s,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+/* Take the whole list of pending slabs of [dr]. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static slab * take_pending_slabs(domain_rings *dr)
+{
+  return atomic_exchange_explicit(&dr->pending, NULL, memory_order_acquire);
+}
+
+/* Wait until the remote deallocations that are recording slabs as
+   pending in [dr] are done. After this, no remote deallocation refers
+   to a slab of [dr] that was untracked, or whose owner had changed,
+   before the wait. */
+/* requires domain lock: NO
+   requires rings lock: NO */
+static void wait_remote_deallocations(domain_rings *dr)
+{
+  /* Pairs with the check in enter_remote_deallocation */
+  atomic_thread_fence(memory_order_seq_cst);
+  while (atomic_load(&dr->pushers) != 0) {
+    /* spin */
+  }
+}
+
+/* Move the pending slabs of [from] to the pending slabs of their
+   current owner, and forget the untracked ones: they are going to be
+   freed. Remote deallocations must have been waited for. */
+/* requires domain lock: YES
+   requires rings lock: YES (orphaned rings) */
+static void forward_pending_slabs(domain_rings *from)
+{
+  slab *s = take_pending_slabs(from);
+  while (s != NULL) {
+    slab *next = s->hd.pending_next;
+    if (s->hd.class == UNTRACKED) atomic_store(&s->hd.pending, 0);
+    else push_pending_slab(rings[dom_id_of_slab(s)], s);
+    s = next;
+  }
+}
+
+/* Merge the remote frees of the slabs that have some. Only these
+   slabs are visited. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void gc_pending_slabs(int dom_id)
+{
+  slab *s = take_pending_slabs(rings[dom_id]);
+  while (s != NULL) {
+    slab *next = s->hd.pending_next;
+    DEBUGassert(dom_id_of_slab(s) == dom_id);
+    /* Later remote frees record the slab again */
+    atomic_store(&s->hd.pending, 0);
+    gc_slab(s, dom_id);
+    try_release_slab(s, dom_id);
+    s = next;
+  }
+}
+
+/* Find the rings of the owner of [s], and return them. The owner
+   cannot change until [leave_remote_deallocation]. */
+/* requires domain lock: NO
+   requires rings lock: NO */
+static domain_rings * enter_remote_deallocation(slab *s)
+{
+  while (1) {
+    int dom_id = dom_id_of_slab(s);
+    DEBUGassert(rings[dom_id] != NULL);
+    domain_rings *dr = rings[dom_id];
+    atomic_fetch_add(&dr->pushers, 1);
+#if OCAML_MULTICORE
+    /* Pairs with the fence in wait_remote_deallocations */
+    if (atomic_load(&s->hd.domain_id) == dom_id) return dr;
+#else
+    return dr;
+#endif
+    /* Slab owner has changed in the meanwhile. Try again. */
+    atomic_fetch_sub(&dr->pushers, 1);
+  }
+}
+
+/* requires domain lock: NO
+   requires rings lock: NO */
+static inline void leave_remote_deallocation(domain_rings *dr)
+{
+  atomic_fetch_sub_explicit(&dr->pushers, 1, memory_order_release);
+}
+
+/* Deallocation of [elem] by a thread that does not hold the lock of
+   the domain that owns its slab. This never blocks: the element is
+   marked as freed in [remote_freed], and the slab is pushed on the
+   list of pending slabs of its owner if it is not already there. The
+   element stays in its ring, and is still scanned, until the owner
+   takes it (see gc_slab). */
+/* requires domain lock: NO
+   requires rings lock: NO */
+static void remote_free(struct elem *elem)
+{
+  incr(&stats.total_remote_free);
+  slab *s = get_slab(elem);
+  domain_rings *owner = enter_remote_deallocation(s);
+  int i = (int)(elem - s->elems);
+  atomic_fetch_or(&s->hd.remote_freed[i / REMOTE_BITS],
+                  (uintptr_t)1 << (i % REMOTE_BITS));
+  /* The owner resets [pending] before taking the bits: either it sees
+     our bit, or we see [pending] reset and push the slab again. */
+  if (!atomic_load(&s->hd.pending) && !atomic_exchange(&s->hd.pending, 1))
+    push_pending_slab(owner, s);
+  leave_remote_deallocation(owner);
 }
 
 /* }}} */
 
 /* {{{ Boxroot API implementation */
 
+#if OCAML_MULTICORE
+static atomic_int setup = 0;
+#else
+static int setup = 0;
+#endif
+
 static inline int is_young_block(value v)
 {
-  if (DEBUG) ++stats.is_young;
+  if (DEBUG) incr(&stats.is_young);
   return Is_block(v) && Is_young(v);
 }
 
-static inline void track_elem(ring elem) {
-  ring *dst = is_young_block(elem->slot) ? &rings.young : &rings.old;
+/* requires domain lock: YES
+   requires rings lock: NO */
+static inline void track_elem(domain_rings *local, ring elem)
+{
+  ring *dst = is_young_block(elem->slot) ? &local->young : &local->old;
   ring_push_back(elem, dst);
 }
 
+/* requires domain lock: YES
+   requires rings lock: NO */
 dll_boxroot dll_boxroot_create(value init)
 {
-  if (DEBUG) ++stats.total_create;
-  ring root = create_elem();
+  if (DEBUG) incr(&stats.total_create);
+  // We might be here because boxroot is not setup.
+  if (!setup) return NULL;
+  int dom_id = Domain_id;
+  domain_rings *local = rings[dom_id];
+  /* Initialize rings on this domain */
+  if (local == NULL) local = init_domain_rings(dom_id);
+  if (local == NULL) return NULL;
+  slab *s = local->slabs;
+  if (UNLIKELY(s == NULL || is_full_slab(s))) {
+#if !OCAML_MULTICORE
+    boxroot_check_thread_hooks();
+#endif
+    /* Remote frees might make room in the current slab */
+    gc_pending_slabs(dom_id);
+    s = find_available_slab(dom_id);
+    if (s == NULL) return NULL;
+  }
+  ring root = alloc_elem(s);
   root->slot = init;
-  track_elem(root);
+  track_elem(local, root);
   return (dll_boxroot)root;
 }
 
@@ -207,23 +739,79 @@ value const * dll_boxroot_get_ref(dll_boxroot root)
   return &(((ring)root)->slot);
 }
 
+/* requires domain lock: NO
+   requires rings lock: NO */
 void dll_boxroot_delete(dll_boxroot root)
 {
+  if (DEBUG) incr(&stats.total_delete);
   struct elem *elem = (ring)root;
-  delete_elem(ring_pop_elem(elem));
+  DEBUGassert(elem != NULL);
+  slab *s = get_slab(elem);
+  int dom_id = dom_id_of_slab(s);
+  if (LIKELY(boxroot_domain_lock_held(dom_id))) {
+    free_elem(s, ring_pop_elem(rings[dom_id], elem));
+    try_release_slab(s, dom_id);
+  } else {
+    /* remote deallocation, merged later by the owner */
+    remote_free(elem);
+  }
+}
+
+/* Modification of an element owned by another domain, which might be
+   scanning it concurrently. We cannot move the element to the young
+   ring of its owner: if it needs to, it is reallocated in the current
+   domain instead. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void remote_modify(dll_boxroot *root, value new_value)
+{
+  struct elem *elem = (ring)*root;
+  slab *s = get_slab(elem);
+  int dom_id = acquire_rings_of_slab(s);
+  if (is_young_block(elem->slot) || !is_young_block(new_value)) {
+    elem->slot = new_value;
+    release_rings(dom_id);
+    return;
+  }
+  release_rings(dom_id);
+  dll_boxroot new_root = dll_boxroot_create(new_value);
+  if (LIKELY(new_root != NULL)) {
+    incr(&stats.total_remote_realloc);
+    *root = new_root;
+    remote_free(elem);
+    return;
+  }
+  /* Better not fail in dll_boxroot_modify. Fail-safe: the element is
+     added to the remembered set, and its slab is never freed, since
+     the remembered set could otherwise still refer to it after the
+     element is deallocated. */
+  dom_id = acquire_rings_of_slab(s);
+  s->hd.pinned = 1;
+  Add_to_ref_table(Caml_state, &elem->slot);
+  elem->slot = new_value;
+  release_rings(dom_id);
 }
 
+/* requires domain lock: YES
+   requires rings lock: NO */
 void dll_boxroot_modify(dll_boxroot *root, value new_value)
 {
+  if (DEBUG) incr(&stats.total_modify);
   ring elem = (ring)*root;
+  DEBUGassert(elem != NULL);
+  int dom_id = dom_id_of_slab(get_slab(elem));
+  if (UNLIKELY(!boxroot_domain_lock_held(dom_id))) {
+    remote_modify(root, new_value);
+    return;
+  }
   value old_value = elem->slot;
   if (is_young_block(old_value) || !is_young_block(new_value)) {
     elem->slot = new_value;
   } else {
-    ring new_elem = ring_pop_elem(elem);
-    new_elem->slot = new_value;
-    track_elem(new_elem);
-    *root = (dll_boxroot)new_elem;
+    domain_rings *local = rings[dom_id];
+    ring_pop_elem(local, elem);
+    elem->slot = new_value;
+    ring_push_back(elem, &local->young);
   }
 }
 
@@ -231,37 +819,57 @@ void dll_boxroot_modify(dll_boxroot *root, value new_value)
 
 /* {{{ Scanning */
 
-static void validate_young_ring() {
-  // nothing to check: the young ring
-  // may contain both new and old values
-  // (including NULL, if roots are used from C)
-}
-
-static void validate_old_ring() {
-  FOREACH_ELEM_IN_RING(elem, rings.old, {
-    assert(!is_young_block(elem->slot));
+static long long validate_ring(ring r, int dom_id, int young)
+{
+  long long count = 0;
+  FOREACH_ELEM_IN_RING(elem, r, {
+    // the young ring may contain both new and old values
+    // (including NULL, if roots are used from C)
+    assert(young || !is_young_block(elem->slot));
+    assert(dom_id_of_slab(get_slab(elem)) == dom_id);
+    assert(elem->next->prev == elem);
+    count++;
   });
+  return count;
 }
 
-static void validate_free_ring() {
-  FOREACH_ELEM_IN_RING(elem, rings.free, {
-    assert(elem->slot == (value)NULL);
-  });
+static long long validate_slab_ring(slab *first_slab, int dom_id, class cl)
+{
+  long long alloc_count = 0;
+  if (first_slab == NULL) return 0;
+  slab *s = first_slab;
+  do {
+    int free_count = 0;
+    assert(dom_id_of_slab(s) == dom_id);
+    assert(s->hd.class == cl);
+    for (struct elem *e = s->hd.free_list; e != NULL; e = e->next) {
+      assert(get_slab(e) == s);
+      free_count++;
+    }
+    assert(free_count + s->hd.alloc_count == SLAB_CAPACITY);
+    alloc_count += s->hd.alloc_count;
+    s = s->hd.next;
+  } while (s != first_slab);
+  return alloc_count;
 }
 
-static void validate_all_rings() {
-  struct stats stats_before = stats;
-  validate_young_ring();
-  validate_old_ring();
-  validate_free_ring();
-  stats = stats_before;
+static void validate(int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  long long elems = validate_ring(local->young, dom_id, 1)
+    + validate_ring(local->old, dom_id, 0);
+  long long alloc_count = validate_slab_ring(local->slabs, dom_id, AVAILABLE)
+    + validate_slab_ring(local->full_slabs, dom_id, FULL);
+  /* Elements deallocated remotely are counted until they are taken
+     out of the rings */
+  assert(elems == alloc_count);
 }
 
 // returns the amount of work done
-static int scan_ring(scanning_action action, void *data, ring r)
+static long long scan_ring(scanning_action action, void *data, ring r)
 {
   if (r == NULL) return 0;
-  int work = 0;
+  long long work = 0;
   FOREACH_ELEM_IN_RING(elem, r, {
     CALL_GC_ACTION(action, data, elem->slot, &elem->slot);
     work++;
@@ -269,57 +877,177 @@ static int scan_ring(scanning_action action, void *data, ring r)
   return work;
 }
 
-static void scan_roots(scanning_action action, void *data)
+/* requires domain lock: YES
+   requires rings lock: YES */
+static void free_empty_slabs(int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  /* We don't scan the full-slab ring, whose slabs are almost-full. */
+  slab *s = local->slabs;
+  if (s == NULL) return;
+  slab *to_free = NULL;
+  /* We free all empty slabs except one, to avoid stuttering effects. */
+  int keep_empty_slabs = 1;
+  do {
+    slab *next = s->hd.next;
+    if (is_empty_slab(s) && !s->hd.pinned) {
+      if (keep_empty_slabs > 0) {
+        --keep_empty_slabs;
+      } else {
+        slab *removed = slab_remove(s, dom_id);
+        removed->hd.class = UNTRACKED;
+        slab_ring_push_back(removed, &to_free);
+      }
+    }
+    s = next;
+  } while (local->slabs != NULL && s != local->slabs);
+  if (to_free == NULL) return;
+  /* Remote deallocations might still be recording some of them as
+     pending. */
+  wait_remote_deallocations(local);
+  forward_pending_slabs(local);
+  free_slab_ring(&to_free);
+}
+
+/* Record the new owner of the slabs of [source], and splice it into
+   [*target]. */
+/* requires domain lock: YES
+   requires rings lock: YES (Orphaned_id) */
+static void move_slab_ring(slab *source, int dom_id, slab **target)
+{
+  if (source == NULL) return;
+  slab *s = source;
+  do {
+    if (dom_id == Orphaned_id) incr(&stats.total_orphaned_slabs);
+    slab_set_dom_id(s, dom_id);
+    s = s->hd.next;
+  } while (s != source);
+  slab_ring_push_back(source, target);
+}
+
+/* The rings of a terminating domain are moved to the orphaned rings,
+   until another domain adopts them at its next scanning. */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void orphan_rings(int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  if (local == NULL) return;
+  acquire_rings(dom_id);
+  gc_pending_slabs(dom_id);
+  acquire_rings(Orphaned_id);
+  domain_rings *orphaned = rings[Orphaned_id];
+  if (local->slabs != NULL || local->full_slabs != NULL)
+    set_orphans_available(1);
+  /* Orphaned slabs are owned by the orphaned rings, so that remote
+     deallocations are recorded there until adoption. */
+  move_slab_ring(local->slabs, Orphaned_id, &orphaned->slabs);
+  move_slab_ring(local->full_slabs, Orphaned_id, &orphaned->full_slabs);
+  ring_push_back(local->young, &orphaned->young);
+  ring_push_back(local->old, &orphaned->old);
+  /* Remote deallocations that started before the change of owner can
+     still record slabs as pending here. */
+  wait_remote_deallocations(local);
+  forward_pending_slabs(local);
+  release_rings(Orphaned_id);
+  /* Reset local rings for later domains spawning with the same id */
+  init_domain_rings(dom_id);
+  release_rings(dom_id);
+}
+
+/* requires domain lock: YES
+   requires rings lock: YES (dom_id) */
+static void adopt_orphaned_rings(int dom_id)
 {
-  int work = 0;
-  if (DEBUG) validate_all_rings();
-  work += scan_ring(action, data, rings.young);
+  /* Orphans are rare */
+  if (!get_orphans_available()) return;
+  acquire_rings(Orphaned_id);
+  domain_rings *orphaned = rings[Orphaned_id];
+  domain_rings *local = rings[dom_id];
+  move_slab_ring(orphaned->slabs, dom_id, &local->slabs);
+  move_slab_ring(orphaned->full_slabs, dom_id, &local->full_slabs);
+  ring_push_back(orphaned->young, &local->young);
+  ring_push_back(orphaned->old, &local->old);
+  orphaned->slabs = NULL;
+  orphaned->full_slabs = NULL;
+  orphaned->young = NULL;
+  orphaned->old = NULL;
+  set_orphans_available(0);
+  /* Take over the remote frees that happened since orphaning */
+  wait_remote_deallocations(orphaned);
+  forward_pending_slabs(orphaned);
+  release_rings(Orphaned_id);
+}
+
+/* requires domain lock: YES
+   requires rings lock: YES */
+static void scan_roots(scanning_action action, void *data, int dom_id)
+{
+  domain_rings *local = rings[dom_id];
+  if (DEBUG) validate(dom_id);
+  /* The first domain arriving there will take ownership of the rings
+     of terminated domains. */
+  adopt_orphaned_rings(dom_id);
+  /* Then perform all the remote deallocations, including those of
+     adopted slabs. */
+  gc_pending_slabs(dom_id);
+  long long work = scan_ring(action, data, local->young);
   if (boxroot_in_minor_collection()) {
-    ring_push_back(rings.young, &rings.old);
-    rings.young = NULL;
+    /* All young values have been promoted: splice the young ring into
+       the old one in O(1). */
+    ring_push_back(local->young, &local->old);
+    local->young = NULL;
     stats.total_scanning_work_minor += work;
   } else {
-    work += scan_ring(action, data, rings.old);
-    free_ring(rings.free);
-    rings.free = NULL;
+    work += scan_ring(action, data, local->old);
     stats.total_scanning_work_major += work;
+    free_empty_slabs(dom_id);
   }
-  if (DEBUG) validate_all_rings();
+  if (DEBUG) validate(dom_id);
 }
 
 /* }}} */
 
 /* {{{ Statistics */
 
-static int64_t time_counter(void)
+static long long time_counter(void)
 {
 #if defined(POSIX_CLOCK)
   struct timespec t;
   clock_gettime(CLOCK_MONOTONIC, &t);
-  return (int64_t)t.tv_sec * (int64_t)1000000000 + (int64_t)t.tv_nsec;
+  return (long long)t.tv_sec * (long long)1000000000 + (long long)t.tv_nsec;
 #else
   return 0;
 #endif
 }
 
-static int average(long long total_work, int nb_collections)
+static long long average(long long total_work, long long nb_collections)
 {
   if (nb_collections <= 0) return -1;
   // round to nearest
   return (total_work + (nb_collections / 2)) / nb_collections;
 }
 
+// 1=KiB, 2=MiB
+static long long kib_of_slabs(long long count, int unit)
+{
+  int log_per_slab = SLAB_LOG_SIZE - unit * 10;
+  if (log_per_slab >= 0) return count << log_per_slab;
+  /* log_per_slab < 0) */
+  return count >> -log_per_slab;
+}
+
 void dll_boxroot_print_stats()
 {
-  printf("minor collections: %d\n"
-         "major collections (and others): %d\n",
+  printf("minor collections: %'lld\n"
+         "major collections (and others): %'lld\n",
          stats.minor_collections,
          stats.major_collections);
 
 #if DEBUG != 0
-  printf("total created: %'d\n"
-         "total deleted: %'d\n"
-         "total modified: %'d\n",
+  printf("total created: %'lld\n"
+         "total deleted: %'lld\n"
+         "total modified: %'lld\n",
          stats.total_create,
          stats.total_delete,
          stats.total_modify);
@@ -327,31 +1055,58 @@ void dll_boxroot_print_stats()
   printf("is_young_block: %'lld\n",
          stats.is_young);
 #endif
-  int scanning_work_minor = average(stats.total_scanning_work_minor, stats.minor_collections);
-  int scanning_work_major = average(stats.total_scanning_work_major, stats.major_collections);
-  long long total_scanning_work = stats.total_scanning_work_minor + stats.total_scanning_work_major;
 
-  int64_t time_per_minor = stats.minor_collections ?
+  if (stats.total_alloced_slabs == 0) return;
+
+  printf("SLAB_LOG_SIZE: %d (%'lld KiB, %'d roots/slab)\n"
+         "total allocated slabs: %'lld (%'lld MiB)\n"
+         "peak allocated slabs: %'lld (%'lld MiB)\n"
+         "total freed slabs: %'lld (%'lld MiB)\n"
+         "total orphaned slabs: %'lld\n",
+         (int)SLAB_LOG_SIZE, kib_of_slabs(1, 1), (int)SLAB_CAPACITY,
+         stats.total_alloced_slabs,
+         kib_of_slabs(stats.total_alloced_slabs, 2),
+         stats.peak_slabs,
+         kib_of_slabs(stats.peak_slabs, 2),
+         stats.total_freed_slabs,
+         kib_of_slabs(stats.total_freed_slabs, 2),
+         stats.total_orphaned_slabs);
+
+  printf("total remote deallocations: %'lld\n"
+         "total remote reallocations: %'lld\n",
+         stats.total_remote_free,
+         stats.total_remote_realloc);
+
+  long long scanning_work_minor =
+    average(stats.total_scanning_work_minor, stats.minor_collections);
+  long long scanning_work_major =
+    average(stats.total_scanning_work_major, stats.major_collections);
+  long long total_scanning_work =
+    stats.total_scanning_work_minor + stats.total_scanning_work_major;
+
+  long long time_per_minor = stats.minor_collections ?
     stats.total_minor_time / stats.minor_collections : 0;
-  int64_t time_per_major = stats.major_collections ?
+  long long time_per_major = stats.major_collections ?
     stats.total_major_time / stats.major_collections : 0;
 
-  printf("work per minor: %'d\n"
-         "work per major: %'d\n"
+  printf("work per minor: %'lld\n"
+         "work per major: %'lld\n"
          "total scanning work: %'lld (%'lld minor, %'lld major)\n",
          scanning_work_minor,
          scanning_work_major,
-         total_scanning_work, stats.total_scanning_work_minor, stats.total_scanning_work_major);
+         total_scanning_work,
+         stats.total_scanning_work_minor,
+         stats.total_scanning_work_major);
 
 #if defined(POSIX_CLOCK)
   printf("average time per minor: %'lldns\n"
          "average time per major: %'lldns\n"
          "peak time per minor: %'lldns\n"
          "peak time per major: %'lldns\n",
-         (long long)time_per_minor,
-         (long long)time_per_major,
-         (long long)stats.peak_minor_time,
-         (long long)stats.peak_major_time);
+         time_per_minor,
+         time_per_major,
+         stats.peak_minor_time,
+         stats.peak_major_time);
 #endif
 }
 
@@ -359,50 +1114,84 @@ void dll_boxroot_print_stats()
 
 /* {{{ Hook setup */
 
-static int setup = 0;
-
-static void scanning_callback(scanning_action action, int only_young, void *data)
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void scanning_callback(scanning_action action, int only_young,
+                              void *data)
 {
+  (void)only_young;
   if (!setup) return;
   int in_minor_collection = boxroot_in_minor_collection();
-  if (in_minor_collection) ++stats.minor_collections;
-  else ++stats.major_collections;
-  int64_t start = time_counter();
-  scan_roots(action, data);
-  int64_t duration = time_counter() - start;
-  int64_t *total = in_minor_collection ? &stats.total_minor_time : &stats.total_major_time;
-  int64_t *peak = in_minor_collection ? &stats.peak_minor_time : &stats.peak_major_time;
+  if (in_minor_collection) incr(&stats.minor_collections);
+  else incr(&stats.major_collections);
+  int dom_id = Domain_id;
+  /* synchronised by domain lock */
+  if (rings[dom_id] == NULL) {
+    /* The elements of terminated domains must be scanned by someone */
+    if (!get_orphans_available() || init_domain_rings(dom_id) == NULL)
+      return;
+  }
+  acquire_rings(dom_id);
+#if !OCAML_MULTICORE
+  boxroot_check_thread_hooks();
+#endif
+  long long start = time_counter();
+  scan_roots(action, data, dom_id);
+  long long duration = time_counter() - start;
+  stat_t *total = in_minor_collection ? &stats.total_minor_time : &stats.total_major_time;
+  stat_t *peak = in_minor_collection ? &stats.peak_minor_time : &stats.peak_major_time;
   *total += duration;
-  if (duration > *peak) *peak = duration;
+  if (duration > *peak) *peak = duration; // racy
+  release_rings(dom_id);
 }
 
+/* Handle orphaning of domain-local rings */
+/* requires domain lock: YES
+   requires rings lock: NO */
+static void domain_termination_callback()
+{
+  DEBUGassert(OCAML_MULTICORE == 1);
+  orphan_rings(Domain_id);
+}
+
+/* Used for initialization/teardown */
+static mutex_t init_mutex = BOXROOT_MUTEX_INITIALIZER;
+
 // Must be called to set the hook before using boxroot
 int dll_boxroot_setup()
 {
-  if (setup) return 0;
-  // initialise globals
-  struct stats empty_stats = {0};
-  stats = empty_stats;
-  rings.young = NULL;
-  rings.old = NULL;
-  rings.free = NULL;
-  boxroot_setup_hooks(&scanning_callback, NULL);
+  int res = 0;
+  boxroot_mutex_lock(&init_mutex);
+  if (setup) goto out;
+  if (NULL == init_domain_rings(Orphaned_id)) goto out;
+  boxroot_setup_hooks(&scanning_callback, &domain_termination_callback,
+                      NULL);
   // we are done
   setup = 1;
-  if (DEBUG) validate_all_rings();
-  return 1;
+  res = 1;
+  // fall through
+ out:
+  boxroot_mutex_unlock(&init_mutex);
+  return res;
 }
 
+// This can only be called at OCaml shutdown
 void dll_boxroot_teardown()
 {
-  if (!setup) return;
+  boxroot_mutex_lock(&init_mutex);
+  if (!setup) goto out;
   setup = 0;
-  free_ring(rings.young);
-  rings.young = NULL;
-  free_ring(rings.old);
-  rings.old = NULL;
-  free_ring(rings.free);
-  rings.free = NULL;
+  for (int i = 0; i < Num_domains + 1; i++) {
+    domain_rings *dr = rings[i];
+    if (dr == NULL) continue;
+    free_slab_ring(&dr->slabs);
+    free_slab_ring(&dr->full_slabs);
+    free(dr);
+    rings[i] = NULL;
+  }
+  // fall through
+ out:
+  boxroot_mutex_unlock(&init_mutex);
 }
 
 /* }}} */
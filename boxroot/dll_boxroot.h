@@ -10,7 +10,8 @@ typedef struct dll_boxroot_private* dll_boxroot;
    value `v`. This value will be considered as a root by the OCaml GC
    as long as the boxroot lives or until it is modified. A return
    value of `NULL` indicates a failure of allocation of the backing
-   store. */
+   store. The OCaml domain lock must be held before calling
+   `dll_boxroot_create`. */
 dll_boxroot dll_boxroot_create(value);
 
 /* `dll_boxroot_get(r)` returns the contained value, subject to the usual
@@ -24,7 +25,8 @@ value const * dll_boxroot_get_ref(dll_boxroot);
 
 /* `dll_boxroot_delete(r)` desallocates the boxroot `r`. The value is no
    longer considered as a root by the OCaml GC. The argument must be
-   non-null. */
+   non-null. The domain lock need not be held: deallocations by other
+   domains and threads are recorded for the domain owning the root. */
 void dll_boxroot_delete(dll_boxroot);
 
 /* `dll_boxroot_modify(&r,v)` changes the value kept alive by the boxroot
@@ -36,14 +38,16 @@ void dll_boxroot_delete(dll_boxroot);
    In particular, the root can be reallocated. However, unlike
    `dll_boxroot_create`, `dll_boxroot_modify` never fails, so `r` is
    guaranteed to be non-NULL afterwards. In addition, `dll_boxroot_modify`
-   is more efficient. Indeed, the reallocation, if needed, occurs at
-   most once between two minor collections. */
+   is more efficient. Indeed, the reallocation, if needed, only
+   happens when modifying a root of another domain. The OCaml domain
+   lock must be held before calling `dll_boxroot_modify`. */
 void dll_boxroot_modify(dll_boxroot *, value);
 
 /* The behaviour of the above functions is well-defined only after the
    allocator has been initialised with `dll_boxroot_setup`, which must be
    called after OCaml startup, and before it has released its
-   resources with `dll_boxroot_teardown`. */
+   resources with `dll_boxroot_teardown`, which can be called after
+   OCaml shutdown. */
 int dll_boxroot_setup();
 void dll_boxroot_teardown();
 
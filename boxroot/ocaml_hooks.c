@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stddef.h>
 
 #include <caml/misc.h>
 #include <caml/minor_gc.h>
@@ -16,42 +17,63 @@
 
 #if OCAML_MULTICORE
 static_assert(Num_domains < INT_MAX);
-static atomic_int in_minor_collection = 0;
-#else
-static int in_minor_collection = 0;
 #endif
 
 static caml_timing_hook prev_minor_begin_hook = NULL;
 static caml_timing_hook prev_minor_end_hook = NULL;
+static caml_timing_hook prev_major_slice_begin_hook = NULL;
+static caml_timing_hook prev_major_slice_end_hook = NULL;
 
-/* In OCaml 5.0, in_minor_collection records the number of parallel
-   domains currently doing a minor collection.
+/* The GC phase is recorded per thread, so that domains do not share a
+   cache line at each collection.
 
    Correctness depends on:
-   - The stop-the-world (STW) nature of minor collection, and the fact
-     that the timing hooks are called inside the STW section.
+   - The fact that the timing hooks and the scanning of roots of a
+     domain are called by the same thread: the thread holding the
+     domain lock (in OCaml 5.x, this can be the backup thread of a
+     domain in a blocking section, which then keeps the domain lock
+     for the whole STW section).
    - The fact that setup_hooks and scanning_callback are called while
      holding a domain lock. Thus, setup_hooks is called outside of a
-     minor collection (in_minor_collection starts at 0 correctly), and
+     collection (boxroot_gc_phase starts at 0 correctly), and
      scanning_callback runs either entirely inside or entirely outside
-     of a STW section.
+     of a collection.
 */
+_Thread_local int boxroot_gc_phase = 0;
+
+static boxroot_gc_event_callback gc_event_callback = NULL;
+
+static inline void notify_gc_event(boxroot_gc_event event)
+{
+  if (gc_event_callback != NULL) gc_event_callback(event);
+}
 
 static void record_minor_begin()
 {
-  in_minor_collection++;
+  boxroot_gc_phase |= BOXROOT_GC_MINOR;
+  notify_gc_event(BOXROOT_MINOR_BEGIN);
   if (prev_minor_begin_hook != NULL) prev_minor_begin_hook();
 }
 
 static void record_minor_end()
 {
-  in_minor_collection--;
+  boxroot_gc_phase &= ~BOXROOT_GC_MINOR;
+  notify_gc_event(BOXROOT_MINOR_END);
   if (prev_minor_end_hook != NULL) prev_minor_end_hook();
 }
 
-int boxroot_in_minor_collection()
+static void record_major_slice_begin()
 {
-  return in_minor_collection != 0;
+  boxroot_gc_phase |= BOXROOT_GC_MAJOR_SLICE;
+  notify_gc_event(BOXROOT_MAJOR_SLICE_BEGIN);
+  if (prev_major_slice_begin_hook != NULL) prev_major_slice_begin_hook();
+}
+
+static void record_major_slice_end()
+{
+  boxroot_gc_phase &= ~BOXROOT_GC_MAJOR_SLICE;
+  notify_gc_event(BOXROOT_MAJOR_SLICE_END);
+  if (prev_major_slice_end_hook != NULL) prev_major_slice_end_hook();
 }
 
 static boxroot_scanning_callback scanning_callback = NULL;
@@ -78,13 +100,15 @@ static void domain_terminated_hook()
   if (prev_domain_terminated_hook != NULL) {
     (*prev_domain_terminated_hook)();
   }
-  (*domain_terminated_callback)();
+  if (domain_terminated_callback != NULL) (*domain_terminated_callback)();
 }
 
 void boxroot_setup_hooks(boxroot_scanning_callback scanning,
-                         caml_timing_hook domain_termination)
+                         caml_timing_hook domain_termination,
+                         boxroot_gc_event_callback gc_event)
 {
   scanning_callback = scanning;
+  gc_event_callback = gc_event;
   // save previous hooks and install ours
   prev_scan_roots_hook = atomic_exchange(&caml_scan_roots_hook,
                                          scan_hook);
@@ -92,6 +116,10 @@ void boxroot_setup_hooks(boxroot_scanning_callback scanning,
                                           record_minor_begin);
   prev_minor_end_hook = atomic_exchange(&caml_minor_gc_end_hook,
                                         record_minor_end);
+  prev_major_slice_begin_hook =
+    atomic_exchange(&caml_major_slice_begin_hook, record_major_slice_begin);
+  prev_major_slice_end_hook =
+    atomic_exchange(&caml_major_slice_end_hook, record_major_slice_end);
   domain_terminated_callback = domain_termination;
   prev_domain_terminated_hook = atomic_exchange(&caml_domain_terminated_hook,
                                                 domain_terminated_hook);
@@ -142,22 +170,49 @@ void boxroot_check_thread_hooks()
 }
 
 void boxroot_setup_hooks(boxroot_scanning_callback scanning,
-                         caml_timing_hook domain_termination)
+                         caml_timing_hook domain_termination,
+                         boxroot_gc_event_callback gc_event)
 {
   scanning_callback = scanning;
+  gc_event_callback = gc_event;
   // save previous hooks
   prev_scan_roots_hook = caml_scan_roots_hook;
   prev_minor_begin_hook = caml_minor_gc_begin_hook;
   prev_minor_end_hook = caml_minor_gc_end_hook;
+  prev_major_slice_begin_hook = caml_major_slice_begin_hook;
+  prev_major_slice_end_hook = caml_major_slice_end_hook;
   // install our hooks
   caml_scan_roots_hook = boxroot_scan_hook;
   caml_minor_gc_begin_hook = record_minor_begin;
   caml_minor_gc_end_hook = record_minor_end;
+  caml_major_slice_begin_hook = record_major_slice_begin;
+  caml_major_slice_end_hook = record_major_slice_end;
   boxroot_check_thread_hooks();
   (void)domain_termination;
 }
 
 #endif // OCAML_MULTICORE
 
+#if OCAML_MULTICORE
+
+void * boxroot_thread_local_ref(void)
+{
+  return &Caml_state_opt;
+}
+
+const size_t boxroot_domain_state_id_offset =
+  offsetof(caml_domain_state, id);
+
+#else
+
+void * boxroot_thread_local_ref(void)
+{
+  return &boxroot_thread_has_lock;
+}
+
+#endif // OCAML_MULTICORE
+
 /* Needed to avoid linking error with Rust */
 extern inline int boxroot_domain_lock_held(int dom_id);
+extern inline int boxroot_in_minor_collection();
+extern inline int boxroot_in_major_slice();
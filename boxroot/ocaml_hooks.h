@@ -2,6 +2,7 @@
 #ifndef OCAML_HOOKS_H
 #define OCAML_HOOKS_H
 
+#include <stddef.h>
 #include <caml/mlvalues.h>
 #include "platform.h"
 
@@ -44,6 +45,17 @@ inline int boxroot_domain_lock_held(int dom_id)
 
 #endif
 
+/* The Rust crate reimplements the fast paths of boxroot.h, but cannot
+   read C thread-local variables. This returns the address of the one
+   read by `boxroot_domain_lock_held` for the calling thread:
+   `Caml_state` with OCaml 5, `boxroot_thread_has_lock` otherwise. */
+void * boxroot_thread_local_ref(void);
+
+#if OCAML_MULTICORE
+/* offsetof(caml_domain_state, id), for the Rust crate */
+extern const size_t boxroot_domain_state_id_offset;
+#endif
+
 #ifdef CAML_INTERNALS
 #include <caml/roots.h>
 #include <caml/signals.h>
@@ -68,10 +80,38 @@ inline int boxroot_domain_lock_held(int dom_id)
 typedef void (*boxroot_scanning_callback) (scanning_action action,
                                            int only_young, void *data);
 
+typedef enum {
+  BOXROOT_MINOR_BEGIN,
+  BOXROOT_MINOR_END,
+  BOXROOT_MAJOR_SLICE_BEGIN,
+  BOXROOT_MAJOR_SLICE_END
+} boxroot_gc_event;
+
+/* Called on the thread running the GC, after the phase of the thread
+   has been updated. */
+typedef void (*boxroot_gc_event_callback) (boxroot_gc_event event);
+
+/* [domain_termination] and [gc_event] can be NULL. There is no hook
+   for domain spawning: per-domain state is initialised lazily. */
 void boxroot_setup_hooks(boxroot_scanning_callback scanning,
-                         caml_timing_hook domain_termination);
+                         caml_timing_hook domain_termination,
+                         boxroot_gc_event_callback gc_event);
+
+/* GC phase of the current thread: a set of the following flags. */
+#define BOXROOT_GC_MINOR 1
+#define BOXROOT_GC_MAJOR_SLICE 2
 
-int boxroot_in_minor_collection();
+extern _Thread_local int boxroot_gc_phase;
+
+inline int boxroot_in_minor_collection()
+{
+  return (boxroot_gc_phase & BOXROOT_GC_MINOR) != 0;
+}
+
+inline int boxroot_in_major_slice()
+{
+  return (boxroot_gc_phase & BOXROOT_GC_MAJOR_SLICE) != 0;
+}
 
 #if !OCAML_MULTICORE
 
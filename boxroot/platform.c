@@ -41,6 +41,11 @@ void boxroot_mutex_lock(pthread_mutex_t *mutex)
   pthread_mutex_lock(mutex);
 }
 
+int boxroot_mutex_trylock(pthread_mutex_t *mutex)
+{
+  return 0 == pthread_mutex_trylock(mutex);
+}
+
 void boxroot_mutex_unlock(pthread_mutex_t *mutex)
 {
   pthread_mutex_unlock(mutex);
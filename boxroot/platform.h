@@ -7,9 +7,11 @@
 #if defined(__GNUC__)
 #define BOXROOT_LIKELY(a) __builtin_expect(!!(a),1)
 #define BOXROOT_UNLIKELY(a) __builtin_expect(!!(a),0)
+#define BOXROOT_PREFETCH(addr) __builtin_prefetch(addr)
 #else
 #define BOXROOT_LIKELY(a) (a)
 #define BOXROOT_UNLIKELY(a) (a)
+#define BOXROOT_PREFETCH(addr) ((void)(addr))
 #endif
 
 #if OCAML_VERSION >= 50000
@@ -40,11 +42,10 @@
 #include <caml/mlvalues.h>
 #include <caml/minor_gc.h>
 #include <caml/roots.h>
+#include <stdatomic.h>
 
 #if OCAML_MULTICORE
 
-#include <stdatomic.h>
-
 typedef atomic_llong stat_t;
 
 static inline long long incr(stat_t *n)
@@ -57,12 +58,18 @@ static inline long long decr(stat_t *n)
   return atomic_fetch_add_explicit(n, -1, memory_order_relaxed) - 1;
 }
 
+static inline void incr_by(stat_t *n, long long k)
+{
+  atomic_fetch_add_explicit(n, k, memory_order_relaxed);
+}
+
 #else
 
 typedef long long stat_t;
 
 static inline long long incr(stat_t *n) { return ++(*n); }
 static inline long long decr(stat_t *n) { return --(*n); }
+static inline void incr_by(stat_t *n, long long k) { *n += k; }
 
 #endif // OCAML_MULTICORE
 
@@ -72,8 +79,19 @@ typedef pthread_mutex_t mutex_t;
 
 int boxroot_initialize_mutex(mutex_t *mutex);
 void boxroot_mutex_lock(mutex_t *mutex);
+/* Return 1 if the mutex has been acquired, 0 if it is already held. */
+int boxroot_mutex_trylock(mutex_t *mutex);
 void boxroot_mutex_unlock(mutex_t *mutex);
 
+/* Hint to the processor in the body of spin-wait loops */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BOXROOT_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define BOXROOT_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define BOXROOT_CPU_RELAX() ((void)0)
+#endif
+
 /* Check integrity of pool structure after each scan, and print
    additional statistics? (slow)
    This can be enabled by passing BOXROOT_DEBUG=1 as argument. */
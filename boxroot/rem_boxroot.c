@@ -6,9 +6,6 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
-#if defined(ENABLE_BOXROOT_MUTEX) && (ENABLE_BOXROOT_MUTEX == 1)
-#include <pthread.h>
-#endif
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -41,9 +38,8 @@
 
 /* {{{ Parameters */
 
-/* Log of the size of the pools (12 = 4KB, an OS page).
-   Recommended: 14. */
-#define POOL_LOG_SIZE 14
+/* See rem_boxroot.h */
+#define POOL_LOG_SIZE REM_POOL_LOG_SIZE
 #define POOL_SIZE ((size_t)1 << POOL_LOG_SIZE)
 
 /* }}} */
@@ -51,8 +47,9 @@
 /* {{{ Data types */
 
 /* Our main data structure is a doubly-linked list of "pools"
-   containing registered boxroots. Allocating boxroots in pools
-   amortizes malloc() calls and improves scanning memory locality.
+   containing registered boxroots, one per domain. Allocating boxroots
+   in pools amortizes malloc() calls and improves scanning memory
+   locality.
 
    Pools are allocated on aligned addresses, which gives us a fast
    way to get the owning pool of a boxroot on deletion.
@@ -84,17 +81,55 @@ typedef union { raw_slot raw; free_slot free; full_slot full; } slot;
 
    When a minor collection happens, no scanning needs to be done as
    the GC already traverses the remembered set. We just add the
-   minor-free-list slots to the major free list.
+   minor-free-list slots to the major free list. Only the pools whose
+   minor free list is non-empty are visited: each domain keeps a list
+   of them.
+
+   Each pool is owned by a domain. Its free lists are protected by the
+   lock of this domain. Other domains and threads never write to the
+   slots they deallocate, since the owner might be reading them
+   during a collection, and the GC might write to the slots of the
+   remembered set: remote deallocations are recorded in
+   [remote_freed], and the owner adds them to the free lists later.
 */
 
+#define REMOTE_BITS ((int)(8 * sizeof(uintptr_t)))
+#define REMOTE_WORDS \
+  ((int)((POOL_SIZE / sizeof(slot) + REMOTE_BITS - 1) / REMOTE_BITS))
+
+typedef enum class {
+  /* In the ring of pools available for allocation */
+  AVAILABLE,
+  /* In the ring of pools found to be full */
+  FULL,
+  /* In no ring: about to be freed */
+  UNTRACKED
+} class;
+
 struct header {
+  /* Free lists, protected by domain lock. Must come first: the
+     inline functions of rem_boxroot.h find it at the address of the
+     pool. */
+  rem_boxroot_fl fl;
+  /* protected by domain lock of domain_id, kept in sync with its
+     location in the pool rings */
+  class class;
   struct pool *prev;
   struct pool *next;
-  slot *major_free_list;
-  slot *minor_free_list;
-  slot *last_minor_free_slot;
-  // invariant: (!is_empty_free_list(minor_free_list) => (last_minor_free_slot != NULL)
-  int alloc_count;
+  /* Whether the pool is in the list of pending pools of its owner,
+     and next pool in this list. Set by remote deallocations, reset by
+     the owner when it takes the pool out of the list. */
+  atomic_int pending;
+  struct pool *pending_next;
+  /* protected by domain lock of domain_id. Whether the pool is in the
+     list of pools with a minor free list of its domain, and next pool
+     in this list. */
+  int minor_listed;
+  struct pool *minor_next;
+  /* Slots deallocated by threads that do not hold the lock of the
+     owning domain, one bit per slot. Set without locking, taken by the
+     owner in [gc_pool]. */
+  atomic_uintptr_t remote_freed[REMOTE_WORDS];
 };
 
 static_assert(POOL_SIZE / sizeof(slot) <= INT_MAX, "pool size too large");
@@ -113,48 +148,97 @@ static_assert(sizeof(pool) == POOL_SIZE, "bad pool size");
 
 /* {{{ Globals */
 
-/* Global pool ring. */
-static pool *pools = NULL;
-
-/* On-the-side ring of pools that were found to be full
-   by find_available_pool(). */
-static pool *full_pools = NULL;
-
-/* Global mutex */
-#if defined(ENABLE_BOXROOT_MUTEX) && (ENABLE_BOXROOT_MUTEX == 1)
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-#define CRITICAL_SECTION_BEGIN() pthread_mutex_lock(&mutex)
-#define CRITICAL_SECTION_END() pthread_mutex_unlock(&mutex)
+/* Per-domain pool rings. */
+typedef struct {
+  /* This mutex synchronises:
+     - the scanning of the pools by their owner with the modification
+       of their roots by other domains (see rem_boxroot_modify),
+     - the access to the orphaned pool rings.
+     The rings of a running domain are otherwise protected by its
+     domain lock. */
+  mutex_t mutex;
+  /* Ring of pools available for allocation. The first one is the
+     current pool, whose free lists are used by the fast path of
+     rem_boxroot_create. */
+  pool *pools;
+  /* On-the-side ring of pools that were found to be full by
+     find_available_pool(). */
+  pool *full_pools;
+  /* Protected by domain lock. List of the pools whose minor free list
+     might be non-empty, linked by [minor_next]. A pool with a
+     non-empty minor free list is always in this list. Emptied at each
+     minor collection. */
+  pool *minor_pools;
+  /* List of pools with remote deallocations, linked by
+     [pending_next]. Lock-free stack: pushed by remote deallocations,
+     taken as a whole by the domain (see gc_pending_pools). */
+  _Atomic(pool *) pending;
+  /* Number of remote deallocations in progress that record pools as
+     pending in this domain (see wait_remote_deallocations). */
+  atomic_int pushers;
+} pool_rings;
+
+/* Constant once allocated. */
+static pool_rings *rings[Num_domains + 1] = { NULL };
+#define Orphaned_id Num_domains
+
+/* Whether the orphaned pool rings might be non-empty. Lets domains
+   skip locking the orphaned pool rings in the common case. Written
+   with the orphaned pool rings lock held. */
+#if OCAML_MULTICORE
+static atomic_int orphans_available = 0;
+#define get_orphans_available()                                         \
+  atomic_load_explicit(&orphans_available, memory_order_acquire)
+#define set_orphans_available(b)                                        \
+  atomic_store_explicit(&orphans_available, (b), memory_order_release)
 #else
-#define CRITICAL_SECTION_BEGIN()
-#define CRITICAL_SECTION_END()
+static int orphans_available = 0;
+#define get_orphans_available() orphans_available
+#define set_orphans_available(b) (orphans_available = (b))
 #endif
 
-struct stats {
-  int minor_collections;
-  int major_collections;
-  atomic_int total_create;
-  atomic_int total_delete;
-  atomic_int total_modify;
-  long long total_scanning_work; // number of slots scanned (including free slots)
-  long long useful_scanning_work; // number of non-free slots scanned
-  int64_t total_major_time;
-  int64_t peak_major_time;
-  int total_alloced_pools;
-  int total_freed_pools;
-  int live_pools; // number of tracked pools
-  int peak_pools; // max live pools at any time
-  int ring_operations; // Number of times hd.next is mutated
-  long long is_young; // number of times is_young was called
-  long long get_pool_header; // number of times get_pool_header was called
-  long long is_free_slot; // number of times is_free_slot was called
-  long long is_empty_free_list; // number of times is_empty_free_list was called
-  long long remember; // number of minor values added to the remembered set
-  long long find_available_pool; // number of times find_available_pool was called
-  long long find_available_pool_work; // total work of find_available_pool was called
-};
-
-static struct stats stats;
+/* Current free lists of a domain without pools */
+static rem_boxroot_fl empty_fl =
+  { &empty_fl
+    , &empty_fl
+    , NULL
+    , -1
+#if OCAML_MULTICORE
+    , -1
+#endif
+  };
+
+/* Synchronisation: via domain lock */
+rem_boxroot_fl *rem_boxroot_current_fl[Num_domains + 1];
+
+static struct {
+  stat_t minor_collections;
+  stat_t major_collections;
+  stat_t total_create;
+  stat_t total_delete;
+  stat_t total_modify;
+  stat_t total_create_slow;
+  stat_t total_delete_slow;
+  stat_t total_remote_free;
+  stat_t total_minor_work; // number of pools visited at minor collections
+  stat_t total_scanning_work; // number of slots scanned (including free slots)
+  stat_t useful_scanning_work; // number of non-free slots scanned
+  stat_t total_major_time;
+  stat_t peak_major_time;
+  stat_t total_alloced_pools;
+  stat_t total_freed_pools;
+  stat_t total_orphaned_pools;
+  stat_t live_pools; // number of tracked pools
+  stat_t peak_pools; // max live pools at any time
+  stat_t ring_operations; // Number of times hd.next is mutated
+  stat_t is_young; // number of times is_young was called
+  stat_t get_pool_header; // number of times get_pool_header was called
+  stat_t is_free_slot; // number of times is_free_slot was called
+  stat_t is_empty_free_list; // number of times is_empty_free_list was called
+  stat_t remember; // number of minor values added to the remembered set
+  stat_t find_available_pool; // number of times find_available_pool was called
+  stat_t find_available_pool_work; // total work of find_available_pool was called
+} stats;
 
 /* }}} */
 
@@ -163,48 +247,141 @@ static struct stats stats;
 // hot path
 static inline pool * get_pool_header(slot *v)
 {
-  if (DEBUG) ++stats.get_pool_header;
-  return (pool *)((uintptr_t)v & ~((uintptr_t)POOL_SIZE - 1));
+  if (DEBUG) incr(&stats.get_pool_header);
+  return (pool *)Get_rem_pool_header(v);
 }
 
 // Return true iff v has the lsb tagged and shares the same msbs as p
 // hot path
 static inline int is_free_slot(raw_slot v, pool *p)
 {
-  if (DEBUG) ++stats.is_free_slot;
+  if (DEBUG) incr(&stats.is_free_slot);
   return ((uintptr_t)p | 1) == (v & (~((uintptr_t)POOL_SIZE - 2)));
 }
 
 // hot path
 static inline int is_empty_free_list(slot *v, pool *p)
 {
-  if (DEBUG) ++stats.is_empty_free_list;
+  if (DEBUG) incr(&stats.is_empty_free_list);
   return ((uintptr_t) v == (uintptr_t)p);
 }
 
 // hot path
 static inline int is_young_block(value v)
 {
-  if (DEBUG) ++stats.is_young;
+  if (DEBUG) incr(&stats.is_young);
   return Is_block(v) && Is_young(v);
 }
 
 // hot path
 static inline void remember(caml_domain_state *dom_st, slot *s)
 {
-  if (DEBUG) ++stats.remember;
+  if (DEBUG) incr(&stats.remember);
   Add_to_ref_table(dom_st, &(s->full));
 }
 
 /* }}} */
 
+/* {{{ Pool ownership */
+
+/* requires domain lock: NO
+   requires pool lock: NO */
+static inline int dom_id_of_pool(pool *p)
+{
+  return rem_dom_id_of_fl(&p->hd.fl);
+}
+
+#if OCAML_MULTICORE
+/* requires domain lock: NO
+   requires pool lock: NO */
+static inline void pool_set_dom_id(pool *p, int dom_id)
+{
+  atomic_store_explicit(&p->hd.fl.domain_id, dom_id, memory_order_relaxed);
+}
+#else
+static inline void pool_set_dom_id(pool *p, int n) { (void)p; (void)n; }
+#endif // OCAML_MULTICORE
+
+/* requires domain lock: NO
+   requires pool lock: NO */
+static inline void acquire_pool_rings(int dom_id)
+{
+  boxroot_mutex_lock(&rings[dom_id]->mutex);
+}
+
+/* requires domain lock: NO
+   requires pool lock: YES */
+static inline void release_pool_rings(int dom_id)
+{
+  boxroot_mutex_unlock(&rings[dom_id]->mutex);
+}
+
+/* requires domain lock: NO
+   requires pool lock: NO */
+static inline int acquire_pool_rings_of_pool(pool *p)
+{
+  int dom_id = dom_id_of_pool(p);
+  while (1) {
+    DEBUGassert(rings[dom_id] != NULL);
+    acquire_pool_rings(dom_id);
+    int new_dom_id = dom_id_of_pool(p);
+    if (dom_id == new_dom_id) return dom_id;
+    /* Pool owner has changed before we could lock it. Try again. */
+    release_pool_rings(dom_id);
+    dom_id = new_dom_id;
+  }
+}
+
+/* requires domain lock: NO
+   requires pool lock: NO */
+static pool_rings * alloc_pool_rings()
+{
+  pool_rings *ps = (pool_rings *)malloc(sizeof(pool_rings));
+  if (ps == NULL) goto out_err;
+  if (!boxroot_initialize_mutex(&ps->mutex)) goto out_err;
+  atomic_init(&ps->pending, NULL);
+  atomic_init(&ps->pushers, 0);
+  return ps;
+ out_err:
+  free(ps);
+  return NULL;
+}
+
+/* requires domain lock: YES
+   requires pool lock: NO */
+static pool_rings * init_pool_rings(int dom_id)
+{
+  pool_rings *local = rings[dom_id];
+  if (local == NULL) local = alloc_pool_rings();
+  if (local == NULL) return NULL;
+  local->pools = NULL;
+  local->full_pools = NULL;
+  local->minor_pools = NULL;
+  /* The list of pending pools has been handed over at orphaning */
+  rem_boxroot_current_fl[dom_id] = &empty_fl;
+  rings[dom_id] = local;
+  return local;
+}
+
+/* The current free lists are those of the first available pool. To
+   be called after each change of the ring of available pools. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void update_current_pool(int dom_id)
+{
+  pool *p = rings[dom_id]->pools;
+  rem_boxroot_current_fl[dom_id] = (p != NULL) ? &p->hd.fl : &empty_fl;
+}
+
+/* }}} */
+
 /* {{{ Ring operations */
 
 static void ring_link(pool *p, pool *q)
 {
   p->hd.next = q;
   q->hd.prev = p;
-  ++stats.ring_operations;
+  incr(&stats.ring_operations);
 }
 
 // insert the ring [source] at the back of [*target].
@@ -256,12 +433,12 @@ static inline free_slot tag_free_slot(slot *s) {
     return (((uintptr_t) s) | 1);
 }
 
-static inline void free_list_push(slot *s, slot **free_list) {
+static inline void free_list_push(slot *s, void **free_list) {
   s->free = tag_free_slot(*free_list);
   *free_list = s;
 }
 
-static inline slot *free_list_pop(slot **free_list) {
+static inline slot *free_list_pop(void **free_list) {
   DEBUGassert (!is_empty_free_list(*free_list, get_pool_header(*free_list)));
   slot *s = *free_list;
   DEBUGassert(is_free_slot(s->raw, get_pool_header(s)));
@@ -282,37 +459,48 @@ static inline slot *empty_free_list(pool *p) {
 static inline int is_full_pool(pool *p)
 {
   // we could also check is_empty_free_list(p->hd.free_list, p)
-  return (p->hd.alloc_count == POOL_ROOTS_CAPACITY);
+  return (p->hd.fl.alloc_count == POOL_ROOTS_CAPACITY);
 }
 
 static inline int is_empty_pool(pool *p)
 {
-  return (p->hd.alloc_count == 0);
+  return (p->hd.fl.alloc_count == 0);
 }
 
 static inline int is_almost_full_pool(pool *p)
 {
-  return (p->hd.alloc_count > POOL_ROOTS_CAPACITY * 3 / 4);
+  return (p->hd.fl.alloc_count > POOL_ROOTS_CAPACITY * 3 / 4);
 }
 
-static pool * get_empty_pool(void)
+static pool * get_empty_pool(int dom_id)
 {
-  ++stats.live_pools;
-  if (stats.live_pools > stats.peak_pools) stats.peak_pools = stats.live_pools;
+  long long live_pools = incr(&stats.live_pools);
+  if (live_pools > stats.peak_pools) stats.peak_pools = live_pools;
 
   pool *p = boxroot_alloc_uninitialised_pool(POOL_SIZE);
   if (p == NULL) return NULL;
-  ++stats.total_alloced_pools;
+  incr(&stats.total_alloced_pools);
 
   ring_link(p, p);
-  p->hd.major_free_list = empty_free_list(p);
-  p->hd.minor_free_list = empty_free_list(p);
-  p->hd.last_minor_free_slot = NULL;
-  p->hd.alloc_count = 0;
+  p->hd.fl.major_free_list = empty_free_list(p);
+  p->hd.fl.minor_free_list = empty_free_list(p);
+  p->hd.fl.last_minor_free_slot = NULL;
+  p->hd.fl.alloc_count = 0;
+#if OCAML_MULTICORE
+  atomic_init(&p->hd.fl.domain_id, dom_id);
+#else
+  (void)dom_id;
+#endif
+  p->hd.class = AVAILABLE;
+  atomic_init(&p->hd.pending, 0);
+  p->hd.pending_next = NULL;
+  p->hd.minor_listed = 0;
+  p->hd.minor_next = NULL;
+  for (int i = 0; i < REMOTE_WORDS; i++) atomic_init(&p->hd.remote_freed[i], 0);
 
   /* Put all the pool elements in its free list. */
   for (slot *s = p->roots + POOL_ROOTS_CAPACITY - 1; s >= p->roots; --s) {
-    free_list_push(s, &(p->hd.major_free_list));
+    free_list_push(s, &(p->hd.fl.major_free_list));
   }
 
   return p;
@@ -325,74 +513,264 @@ static pool * get_empty_pool(void)
 
    Returns NULL if none was found and the allocation of a new
    one failed. */
-static pool * find_available_pool(void)
+/* requires domain lock: YES
+   requires pool lock: NO */
+static pool * find_available_pool(int dom_id)
 {
-  if (DEBUG) stats.find_available_pool++;
-  while (pools != NULL && is_full_pool(pools)) {
-    if (DEBUG) stats.find_available_pool_work++;
-    ring_push_back(ring_pop(&pools), &full_pools);
+  pool_rings *local = rings[dom_id];
+  if (DEBUG) incr(&stats.find_available_pool);
+  while (local->pools != NULL && is_full_pool(local->pools)) {
+    if (DEBUG) incr(&stats.find_available_pool_work);
+    pool *p = ring_pop(&local->pools);
+    p->hd.class = FULL;
+    ring_push_back(p, &local->full_pools);
   }
-  if (pools == NULL) {
-    if (DEBUG) stats.find_available_pool_work++;
-    pools = get_empty_pool();
-    if (pools == NULL) return NULL;
+  if (local->pools == NULL) {
+    if (DEBUG) incr(&stats.find_available_pool_work);
+    local->pools = get_empty_pool(dom_id);
   }
-  if (DEBUG) stats.find_available_pool_work++;
-  assert(pools != NULL && !is_full_pool(pools));
-  return pools;
+  update_current_pool(dom_id);
+  if (local->pools == NULL) return NULL;
+  if (DEBUG) incr(&stats.find_available_pool_work);
+  assert(!is_full_pool(local->pools));
+  return local->pools;
 }
 
-// remove the given pool from its global pool ring
-static pool *pool_remove(pool *p)
+// remove the given pool from its pool ring
+/* requires domain lock: YES
+   requires pool lock: NO */
+static pool *pool_remove(pool *p, int dom_id)
 {
+  pool_rings *local = rings[dom_id];
   pool *removed = ring_pop(&p);
-  if (removed == pools) pools = p;
-  if (removed == full_pools) full_pools = p;
+  if (removed == local->pools) local->pools = p;
+  if (removed == local->full_pools) local->full_pools = p;
   return removed;
 }
 
-static void free_all_pools(void) {
-  while (pools != NULL) {
-    pool *p = ring_pop(&pools);
+/* Move a pool of the full-pool ring that has enough free slots again
+   back to the ring of available pools. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void try_release_pool(pool *p, int dom_id)
+{
+  if (p->hd.class != FULL || is_almost_full_pool(p)) return;
+  if (DEBUG) incr(&stats.find_available_pool_work);
+  pool *removed = pool_remove(p, dom_id);
+  removed->hd.class = AVAILABLE;
+  ring_push_back(removed, &rings[dom_id]->pools);
+  update_current_pool(dom_id);
+}
+
+/* Record a pool whose minor free list has become non-empty for the
+   next minor collection. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void track_minor_free_list(pool *p, int dom_id)
+{
+  if (p->hd.minor_listed
+      || is_empty_free_list(p->hd.fl.minor_free_list, p)) return;
+  pool_rings *local = rings[dom_id];
+  p->hd.minor_listed = 1;
+  p->hd.minor_next = local->minor_pools;
+  local->minor_pools = p;
+}
+
+static void free_pool_ring(pool **ring)
+{
+  while (*ring != NULL) {
+    pool *p = ring_pop(ring);
     boxroot_free_pool(p);
-    ++stats.total_freed_pools;
+    incr(&stats.total_freed_pools);
+    decr(&stats.live_pools);
   }
 }
 
 /* }}} */
 
-/* {{{ Allocation, deallocation */
+/* {{{ Remote deallocation */
 
-static int setup;
+static inline int lowest_bit(uintptr_t w)
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll(w);
+#else
+  int n = 0;
+  for (; !(w & 1); w >>= 1) n++;
+  return n;
+#endif
+}
 
-// fails if the front pool is full
-// hot path
-static inline slot * alloc_slot(int for_young)
-{
-  pool *p = pools;
-  if (UNLIKELY(p == NULL || is_full_pool(p))) {
-    // We might be here because boxroot is not setup.
-    if (!setup) {
-      fprintf(stderr, "boxroot is not setup\n");
-      return NULL;
+/* Add the slots deallocated remotely to the free lists. Those that
+   still contain a young value go to the minor free list, as they are
+   still in the remembered set. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void gc_pool(pool *p)
+{
+  for (int i = 0; i < REMOTE_WORDS; i++) {
+    atomic_uintptr_t *w = &p->hd.remote_freed[i];
+    if (0 == atomic_load_explicit(w, memory_order_relaxed)) continue;
+    uintptr_t bits = atomic_exchange(w, 0);
+    for (; bits != 0; bits &= bits - 1) {
+      slot *s = &p->roots[i * REMOTE_BITS + lowest_bit(bits)];
+      rem_boxroot_free_slot(&p->hd.fl, (rem_boxroot)s);
     }
-    p = find_available_pool();
-    if (p == NULL) return NULL;
-    assert(!is_full_pool(p));
   }
-  p->hd.alloc_count++;
+}
+
+/* Record that [p] has remote frees. [p->hd.pending] has been set by
+   the caller. */
+/* requires domain lock: NO
+   requires pool lock: NO */
+static void push_pending_pool(pool_rings *ps, pool *p)
+{
+  pool *head = atomic_load_explicit(&ps->pending, memory_order_relaxed);
+  do {
+    p->hd.pending_next = head;
+  } while (!atomic_compare_exchange_weak_explicit(&ps->pending, &head, p,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+/* Take the whole list of pending pools of [ps]. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static pool * take_pending_pools(pool_rings *ps)
+{
+  return atomic_exchange_explicit(&ps->pending, NULL, memory_order_acquire);
+}
+
+/* Wait until the remote deallocations that are recording pools as
+   pending in [ps] are done. After this, no remote deallocation refers
+   to a pool of [ps] that was untracked, or whose owner had changed,
+   before the wait. */
+/* requires domain lock: NO
+   requires pool lock: NO */
+static void wait_remote_deallocations(pool_rings *ps)
+{
+  /* Pairs with the check in enter_remote_deallocation */
+  atomic_thread_fence(memory_order_seq_cst);
+  while (atomic_load(&ps->pushers) != 0) {
+    /* spin */
+  }
+}
+
+/* Move the pending pools of [from] to the pending pools of their
+   current owner, and forget the untracked ones: they are going to be
+   freed. Remote deallocations must have been waited for. */
+/* requires domain lock: YES
+   requires pool lock: YES (orphaned pool rings) */
+static void forward_pending_pools(pool_rings *from)
+{
+  pool *p = take_pending_pools(from);
+  while (p != NULL) {
+    pool *next = p->hd.pending_next;
+    if (p->hd.class == UNTRACKED) atomic_store(&p->hd.pending, 0);
+    else push_pending_pool(rings[dom_id_of_pool(p)], p);
+    p = next;
+  }
+}
+
+/* Merge the remote frees of the pools that have some. Only these
+   pools are visited. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void gc_pending_pools(int dom_id)
+{
+  pool *p = take_pending_pools(rings[dom_id]);
+  while (p != NULL) {
+    pool *next = p->hd.pending_next;
+    DEBUGassert(dom_id_of_pool(p) == dom_id);
+    /* Later remote frees record the pool again */
+    atomic_store(&p->hd.pending, 0);
+    gc_pool(p);
+    track_minor_free_list(p, dom_id);
+    try_release_pool(p, dom_id);
+    p = next;
+  }
+}
+
+/* Find the pool rings of the owner of [p], and return them. The
+   owner cannot change until [leave_remote_deallocation]. */
+/* requires domain lock: NO
+   requires pool lock: NO */
+static pool_rings * enter_remote_deallocation(pool *p)
+{
+  while (1) {
+    int dom_id = dom_id_of_pool(p);
+    DEBUGassert(rings[dom_id] != NULL);
+    pool_rings *ps = rings[dom_id];
+    atomic_fetch_add(&ps->pushers, 1);
+#if OCAML_MULTICORE
+    /* Pairs with the fence in wait_remote_deallocations */
+    if (atomic_load(&p->hd.fl.domain_id) == dom_id) return ps;
+#else
+    return ps;
+#endif
+    /* Pool owner has changed in the meanwhile. Try again. */
+    atomic_fetch_sub(&ps->pushers, 1);
+  }
+}
+
+/* requires domain lock: NO
+   requires pool lock: NO */
+static inline void leave_remote_deallocation(pool_rings *ps)
+{
+  atomic_fetch_sub_explicit(&ps->pushers, 1, memory_order_release);
+}
+
+/* Deallocation of [s] by a thread that does not hold the lock of the
+   domain that owns its pool. This never blocks: the slot is marked as
+   freed in [remote_freed], and the pool is pushed on the list of
+   pending pools of its owner if it is not already there. The slot
+   keeps its value, and its place in the remembered set, until the
+   owner adds it to a free list (see gc_pool). */
+/* requires domain lock: NO
+   requires pool lock: NO */
+static void remote_free(slot *s)
+{
+  incr(&stats.total_remote_free);
+  pool *p = get_pool_header(s);
+  pool_rings *owner = enter_remote_deallocation(p);
+  int i = (int)(s - p->roots);
+  atomic_fetch_or(&p->hd.remote_freed[i / REMOTE_BITS],
+                  (uintptr_t)1 << (i % REMOTE_BITS));
+  /* The owner resets [pending] before taking the bits: either it sees
+     our bit, or we see [pending] reset and push the pool again. */
+  if (!atomic_load(&p->hd.pending) && !atomic_exchange(&p->hd.pending, 1))
+    push_pending_pool(owner, p);
+  leave_remote_deallocation(owner);
+}
+
+/* }}} */
+
+/* {{{ Allocation, deallocation */
+
+#if OCAML_MULTICORE
+static atomic_int setup = 0;
+#else
+static int setup = 0;
+#endif
+
+/* fails if the pool is full */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static inline slot * alloc_slot(pool *p, int for_young)
+{
+  p->hd.fl.alloc_count++;
   if (for_young) {
-    if (LIKELY(!is_empty_free_list(p->hd.minor_free_list, p))) {
-      return free_list_pop(&(p->hd.minor_free_list));
+    if (LIKELY(!is_empty_free_list(p->hd.fl.minor_free_list, p))) {
+      return free_list_pop(&(p->hd.fl.minor_free_list));
     } else {
       // take a major slot, add it to the remembered set
-      slot *new_slot = free_list_pop(&(p->hd.major_free_list));
+      slot *new_slot = free_list_pop(&(p->hd.fl.major_free_list));
       remember(Caml_state, new_slot);
       return new_slot;
     }
   } else {
-    if (LIKELY(!is_empty_free_list(p->hd.major_free_list, p))) {
-      return free_list_pop(&(p->hd.major_free_list));
+    if (LIKELY(!is_empty_free_list(p->hd.fl.major_free_list, p))) {
+      return free_list_pop(&(p->hd.fl.major_free_list));
     } else {
       /* If there are minor slots available, but no major slots left, we
          just reuse a minor slot, forgetting that it is in the
@@ -404,32 +782,60 @@ static inline slot * alloc_slot(int for_young)
          (if we have to look over all pools without finding anything)
          and we don't know of a good, simple strategy to avoid them.
       */
-      return free_list_pop(&(p->hd.minor_free_list));
+      return free_list_pop(&(p->hd.fl.minor_free_list));
     }
   }
 }
 
-// hot path
-static inline void dealloc_slot(slot *v) {
-  pool *p = get_pool_header(v);
-  if (!is_young_block(v->full)) {
-    free_list_push(v, &(p->hd.major_free_list));
-  } else {
-    /* If the performance of the branch below matters, then we are in
-       the case where many young boxroots are deleted, so the check is
-       UNLIKELY. */
-    if (UNLIKELY(is_empty_free_list(p->hd.minor_free_list, p))) {
-      p->hd.last_minor_free_slot = v;
-    }
-    free_list_push(v, &(p->hd.minor_free_list));
+/* Reached when the free list of the current pool matching the value
+   is empty, or when there is no current pool. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+rem_boxroot rem_boxroot_create_slow(value init)
+{
+  incr(&stats.total_create_slow);
+  // We might be here because boxroot is not setup.
+  if (!setup) {
+    fprintf(stderr, "boxroot is not setup\n");
+    return NULL;
+  }
+#if !OCAML_MULTICORE
+  boxroot_check_thread_hooks();
+#endif
+  int dom_id = Domain_id;
+  pool_rings *local = rings[dom_id];
+  /* Initialize pool rings on this domain */
+  if (local == NULL) local = init_pool_rings(dom_id);
+  if (local == NULL) return NULL;
+  pool *p = local->pools;
+  if (p == NULL || is_full_pool(p)) {
+    /* Remote frees might make room in the current pool */
+    gc_pending_pools(dom_id);
+    p = find_available_pool(dom_id);
+    if (p == NULL) return NULL;
   }
-  p->hd.alloc_count--;
-  if (UNLIKELY(p->hd.alloc_count == POOL_ROOTS_CAPACITY * 3 / 4)) {
-    // the pool at this point is either in 'pools' or 'full_pools';
-    // ensure that it goes back to 'pools' in any case.
-    if (DEBUG) stats.find_available_pool_work++;
-    pool *removed = pool_remove(p);
-    ring_push_back(removed, &pools);
+  slot *cell = alloc_slot(p, is_young_block(init));
+  cell->full = init;
+  return (rem_boxroot)cell;
+}
+
+/* requires domain lock: NO
+   requires pool lock: NO */
+void rem_boxroot_delete_slow(rem_boxroot root)
+{
+  incr(&stats.total_delete_slow);
+  slot *cell = (slot *)root;
+  /* recomputing these avoids spilling in rem_boxroot_delete */
+  pool *p = get_pool_header(cell);
+  int dom_id = dom_id_of_pool(p);
+  if (boxroot_domain_lock_held(dom_id)) {
+    /* deallocation already done, but we passed a deallocation
+       threshold or started the minor free list */
+    track_minor_free_list(p, dom_id);
+    try_release_pool(p, dom_id);
+  } else {
+    /* remote deallocation, merged later by the owner */
+    remote_free(cell);
   }
 }
 
@@ -437,39 +843,38 @@ static inline void dealloc_slot(slot *v) {
 
 /* {{{ Boxroot API implementation */
 
-// hot path
-rem_boxroot rem_boxroot_create(value init)
+extern inline rem_boxroot rem_boxroot_create(value init);
+extern inline value rem_boxroot_get(rem_boxroot root);
+extern inline value const * rem_boxroot_get_ref(rem_boxroot root);
+extern inline int rem_boxroot_free_slot(rem_boxroot_fl *fl, rem_boxroot root);
+extern inline void rem_boxroot_delete(rem_boxroot root);
+
+void rem_boxroot_create_debug(value init)
 {
-  if (DEBUG) ++stats.total_create;
-  CRITICAL_SECTION_BEGIN();
-  slot *cell = alloc_slot(is_young_block(init));
-  CRITICAL_SECTION_END();
-  if (UNLIKELY(cell == NULL)) return NULL;
-  cell->full = init;
-  return (rem_boxroot)cell;
+  (void)init;
+  incr(&stats.total_create);
 }
 
-extern value rem_boxroot_get(rem_boxroot root);
-extern value const * rem_boxroot_get_ref(rem_boxroot root);
-
-// hot path
-void rem_boxroot_delete(rem_boxroot root)
+void rem_boxroot_delete_debug(rem_boxroot root)
 {
-  if (DEBUG) ++stats.total_delete;
-  slot *cell = (slot *)root;
-  DEBUGassert(cell != NULL);
-  CRITICAL_SECTION_BEGIN();
-  dealloc_slot(cell);
-  CRITICAL_SECTION_END();
+  DEBUGassert(root != NULL);
+  incr(&stats.total_delete);
 }
 
 // hot path
+/* requires domain lock: YES
+   requires pool lock: NO */
 void rem_boxroot_modify(rem_boxroot *root, value new_value)
 {
-  if (DEBUG) ++stats.total_modify;
+  if (DEBUG) incr(&stats.total_modify);
   slot *cell = (slot *)*root;
   DEBUGassert(cell != NULL);
-  // no need for a critical section here, we do not touch the pool structure
+  pool *p = get_pool_header(cell);
+  int dom_id = dom_id_of_pool(p);
+  /* We do not touch the pool structure. But a root of another domain
+     could be concurrently scanned by its owner. */
+  int remote = !boxroot_domain_lock_held(dom_id);
+  if (remote) dom_id = acquire_pool_rings_of_pool(p);
   if (!is_young_block(new_value)) {
     cell->full = new_value;
   } else {
@@ -477,6 +882,7 @@ void rem_boxroot_modify(rem_boxroot *root, value new_value)
     cell->full = new_value;
     if (!is_young_block(old_value)) remember(Caml_state, cell);
   }
+  if (remote) release_pool_rings(dom_id);
 }
 
 /* }}} */
@@ -506,73 +912,99 @@ static void validate_free_list(pool *p, slot *free_list, long *out_free_list_cou
   *out_free_list_count += count;
 }
 
-static void validate_pool(pool *p) {
+static void validate_pool(pool *p, int dom_id, class cl) {
   long free_roots_count = 0, full_roots_count = 0, free_list_count = 0;
+  assert(dom_id_of_pool(p) == dom_id);
+  assert(p->hd.class == cl);
   validate_roots(p, &free_roots_count, &full_roots_count);
-  validate_free_list(p, p->hd.major_free_list, &free_list_count);
-  validate_free_list(p, p->hd.minor_free_list, &free_list_count);
-  assert(is_empty_free_list(p->hd.minor_free_list, p)
-         || (p->hd.last_minor_free_slot != NULL
-             && is_free_slot(p->hd.last_minor_free_slot->raw, p)));
+  validate_free_list(p, p->hd.fl.major_free_list, &free_list_count);
+  validate_free_list(p, p->hd.fl.minor_free_list, &free_list_count);
+  slot *last = p->hd.fl.last_minor_free_slot;
+  assert(is_empty_free_list(p->hd.fl.minor_free_list, p)
+         || (last != NULL && is_free_slot(last->raw, p)));
   assert(free_roots_count == free_list_count);
-  assert(full_roots_count == p->hd.alloc_count);
+  assert(full_roots_count == p->hd.fl.alloc_count);
   assert(free_roots_count + full_roots_count == POOL_ROOTS_CAPACITY);
+  assert(p->hd.minor_listed
+         || is_empty_free_list(p->hd.fl.minor_free_list, p));
 }
 
-static void validate_pool_ring(pool *first_pool) {
+static void validate_pool_ring(pool *first_pool, int dom_id, class cl) {
   if (first_pool == NULL) return;
   pool *p = first_pool;
   do {
-    validate_pool(p);
+    validate_pool(p, dom_id, cl);
     p = p->hd.next;
   } while (p != first_pool);
 }
 
-static void validate(void)
+static void validate(int dom_id)
 {
-  validate_pool_ring(pools);
-  validate_pool_ring(full_pools);
+  pool_rings *local = rings[dom_id];
+  validate_pool_ring(local->pools, dom_id, AVAILABLE);
+  validate_pool_ring(local->full_pools, dom_id, FULL);
+  pool *p = local->pools;
+  assert(rem_boxroot_current_fl[dom_id] == (p ? &p->hd.fl : &empty_fl));
+}
+
+/* The remembered set is cleared by the minor collection, so the
+   "minor" free list slots must now be moved to the major free
+   list. */
+static void splice_minor_free_list(pool *p)
+{
+  if (!is_empty_free_list(p->hd.fl.minor_free_list, p)) {
+    slot *last = p->hd.fl.last_minor_free_slot;
+    assert(last != NULL);
+    assert(is_free_slot(((slot *)p->hd.fl.minor_free_list)->raw, p));
+    assert(is_empty_free_list(untag_free_slot(last->free), p));
+    last->free = tag_free_slot(p->hd.fl.major_free_list);
+    p->hd.fl.major_free_list = p->hd.fl.minor_free_list;
+    p->hd.fl.minor_free_list = empty_free_list(p);
+  }
 }
 
+/* We use the remembered set for minor boxroots, so no scanning is
+   necessary on minor collections: only the pools with a minor free
+   list are visited. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void splice_minor_free_lists(int dom_id)
+{
+  pool_rings *local = rings[dom_id];
+  pool *p = local->minor_pools;
+  local->minor_pools = NULL;
+  while (p != NULL) {
+    pool *next = p->hd.minor_next;
+    splice_minor_free_list(p);
+    p->hd.minor_listed = 0;
+    p->hd.minor_next = NULL;
+    incr(&stats.total_minor_work);
+    p = next;
+  }
+}
+
+/* Only called at major collections */
 static void scan_pool(scanning_action action, void *data, pool *p)
 {
-  if (boxroot_in_minor_collection()) {
-      /* We use the remembered set for minor boxroots,
-         so no scanning is necesary on minor collections.
-
-         The remembered set is cleared by the minor collection, so the
-         "minor" free list slots must now be moved to the major free
-         list. */
-      if (!is_empty_free_list(p->hd.minor_free_list, p)) {
-        assert(p->hd.last_minor_free_slot != NULL);
-        assert(is_free_slot(p->hd.minor_free_list->raw, p));
-        assert(is_empty_free_list(untag_free_slot(p->hd.last_minor_free_slot->free), p));
-        p->hd.last_minor_free_slot->free = tag_free_slot(p->hd.major_free_list);
-        p->hd.major_free_list = p->hd.minor_free_list;
-        p->hd.minor_free_list = empty_free_list(p);
-      }
+  int allocs_to_find = p->hd.fl.alloc_count;
+  stats.useful_scanning_work += p->hd.fl.alloc_count;
+  for (slot *current = p->roots;
+       current < p->roots + POOL_ROOTS_CAPACITY;
+       ++current) {
+    if (allocs_to_find == 0) {
+      stats.total_scanning_work += (current - p->roots);
       return;
-  } else {
-    int allocs_to_find = p->hd.alloc_count;
-    stats.useful_scanning_work += p->hd.alloc_count;
-    for (slot *current = p->roots;
-         current < p->roots + POOL_ROOTS_CAPACITY;
-         ++current) {
-      if (allocs_to_find == 0) {
-        stats.total_scanning_work += (current - p->roots);
-        return;
-      }
-      if (!is_free_slot(current->raw, p)) {
-        /* we only scan in the major collection,
-           after young blocks have been oldified */
-        DEBUGassert(!is_young_block(current->full));
-        --allocs_to_find;
-        CALL_GC_ACTION(action, data, current->full, &(current->full));
-      }
     }
-    assert(allocs_to_find == 0);
-    stats.total_scanning_work += POOL_ROOTS_CAPACITY;
+    if (!is_free_slot(current->raw, p)) {
+      /* we only scan in the major collection,
+         after young blocks have been oldified */
+      DEBUGassert(!is_young_block(current->full));
+      --allocs_to_find;
+      CALL_GC_ACTION(action, data, current->full, &(current->full));
+    }
   }
+  assert(allocs_to_find == 0);
+  stats.total_scanning_work += POOL_ROOTS_CAPACITY;
 }
 
 static void scan_pool_ring(scanning_action action, void *data, pool *first_pool)
@@ -585,51 +1017,148 @@ static void scan_pool_ring(scanning_action action, void *data, pool *first_pool)
   } while (p != first_pool);
 }
 
-static void free_empty_pools(void) {
+/* requires domain lock: YES
+   requires pool lock: YES */
+static void free_empty_pools(int dom_id) {
+  pool_rings *local = rings[dom_id];
   /* We don't scan the full-pool ring, whose pools are almost-full. */
-  pool *p = pools;
+  pool *p = local->pools;
+  if (p == NULL) return;
+  pool *to_free = NULL;
   /* We free all empty pools except one, to avoid stuttering effects. */
   int keep_empty_pools = 1;
   do {
     pool *next = p->hd.next;
-    if (is_empty_pool(p)) {
+    /* With OCaml 4.14, a major cycle can start before the minor heap
+       is emptied: the remembered set can still refer to the slots of
+       the minor free list. */
+    if (is_empty_pool(p) && !p->hd.minor_listed) {
       if (keep_empty_pools > 0) {
         --keep_empty_pools;
       } else {
-        boxroot_free_pool(pool_remove(p));
-        ++stats.total_freed_pools;
+        pool *removed = pool_remove(p, dom_id);
+        removed->hd.class = UNTRACKED;
+        ring_push_back(removed, &to_free);
       }
     }
     p = next;
-  } while (p != pools);
+  } while (local->pools != NULL && p != local->pools);
+  update_current_pool(dom_id);
+  if (to_free == NULL) return;
+  /* Remote deallocations might still be recording some of them as
+     pending. */
+  wait_remote_deallocations(local);
+  forward_pending_pools(local);
+  free_pool_ring(&to_free);
 }
 
-static void scan_roots(scanning_action action, void *data)
+/* Record the new owner of the pools of [ring], and splice it into
+   [*target]. */
+/* requires domain lock: YES
+   requires pool lock: YES (Orphaned_id) */
+static void move_ring(pool *ring, int dom_id, pool **target)
 {
-  if (DEBUG) validate();
-  scan_pool_ring(action, data, pools);
-  scan_pool_ring(action, data, full_pools);
-  free_empty_pools();
-  if (DEBUG) validate();
+  if (ring == NULL) return;
+  pool *p = ring;
+  do {
+    if (dom_id == Orphaned_id) incr(&stats.total_orphaned_pools);
+    pool_set_dom_id(p, dom_id);
+    p = p->hd.next;
+  } while (p != ring);
+  ring_push_back(ring, target);
+}
+
+/* The pools of a terminating domain are moved to the orphaned pool
+   rings, until another domain adopts them at its next scanning. They
+   are not scanned at minor collections meanwhile, so their minor
+   free lists are given up. */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void orphan_pools(int dom_id)
+{
+  pool_rings *local = rings[dom_id];
+  if (local == NULL) return;
+  acquire_pool_rings(dom_id);
+  gc_pending_pools(dom_id);
+  splice_minor_free_lists(dom_id);
+  acquire_pool_rings(Orphaned_id);
+  pool_rings *orphaned = rings[Orphaned_id];
+  if (local->pools != NULL || local->full_pools != NULL)
+    set_orphans_available(1);
+  /* Orphaned pools are owned by the orphaned pool rings, so that
+     remote deallocations are recorded there until adoption. */
+  move_ring(local->pools, Orphaned_id, &orphaned->pools);
+  move_ring(local->full_pools, Orphaned_id, &orphaned->full_pools);
+  /* Remote deallocations that started before the change of owner can
+     still record pools as pending here. */
+  wait_remote_deallocations(local);
+  forward_pending_pools(local);
+  release_pool_rings(Orphaned_id);
+  /* Reset local pools for later domains spawning with the same id */
+  init_pool_rings(dom_id);
+  release_pool_rings(dom_id);
+}
+
+/* requires domain lock: YES
+   requires pool lock: YES (dom_id) */
+static void adopt_orphaned_pools(int dom_id)
+{
+  /* Orphans are rare */
+  if (!get_orphans_available()) return;
+  acquire_pool_rings(Orphaned_id);
+  pool_rings *orphaned = rings[Orphaned_id];
+  pool_rings *local = rings[dom_id];
+  move_ring(orphaned->pools, dom_id, &local->pools);
+  move_ring(orphaned->full_pools, dom_id, &local->full_pools);
+  orphaned->pools = NULL;
+  orphaned->full_pools = NULL;
+  set_orphans_available(0);
+  /* Take over the remote frees that happened since orphaning */
+  wait_remote_deallocations(orphaned);
+  forward_pending_pools(orphaned);
+  release_pool_rings(Orphaned_id);
+  update_current_pool(dom_id);
+}
+
+/* requires domain lock: YES
+   requires pool lock: YES */
+static void scan_roots(scanning_action action, void *data, int dom_id)
+{
+  pool_rings *local = rings[dom_id];
+  if (DEBUG) validate(dom_id);
+  /* The first domain arriving there will take ownership of the pools
+     of terminated domains. */
+  adopt_orphaned_pools(dom_id);
+  /* Then perform all the remote deallocations, including those of
+     adopted pools. */
+  gc_pending_pools(dom_id);
+  if (boxroot_in_minor_collection()) {
+    splice_minor_free_lists(dom_id);
+  } else {
+    scan_pool_ring(action, data, local->pools);
+    scan_pool_ring(action, data, local->full_pools);
+    free_empty_pools(dom_id);
+  }
+  if (DEBUG) validate(dom_id);
 }
 
 /* }}} */
 
 /* {{{ Statistics */
 
-static int64_t time_counter(void)
+static long long time_counter(void)
 {
 #if defined(POSIX_CLOCK)
   struct timespec t;
   clock_gettime(CLOCK_MONOTONIC, &t);
-  return (int64_t)t.tv_sec * (int64_t)1000000000 + (int64_t)t.tv_nsec;
+  return (long long)t.tv_sec * (long long)1000000000 + (long long)t.tv_nsec;
 #else
   return 0;
 #endif
 }
 
 // 1=KiB, 2=MiB
-static int kib_of_pools(int count, int unit)
+static long long kib_of_pools(long long count, int unit)
 {
   int log_per_pool = POOL_LOG_SIZE - unit * 10;
   if (log_per_pool >= 0) return count << log_per_pool;
@@ -637,7 +1166,7 @@ static int kib_of_pools(int count, int unit)
   return count >> -log_per_pool;
 }
 
-static int average(long long total_work, int nb_collections)
+static long long average(long long total_work, long long nb_collections)
 {
   if (nb_collections <= 0) return -1;
   // round to nearest
@@ -646,42 +1175,47 @@ static int average(long long total_work, int nb_collections)
 
 static int boxroot_used()
 {
-  return (pools != NULL || stats.ring_operations > 0);
+  return (stats.total_alloced_pools > 0);
 }
 
 void rem_boxroot_print_stats()
 {
-  printf("minor collections: %d\n"
-         "major collections (and others): %d\n",
+  printf("minor collections: %'lld\n"
+         "major collections (and others): %'lld\n",
          stats.minor_collections,
          stats.major_collections);
 
-  int scanning_work = average(stats.total_scanning_work, stats.major_collections);
-  int useful_scanning_work = average(stats.useful_scanning_work, stats.major_collections);
-  int ring_operations_per_pool = average(stats.ring_operations, stats.total_alloced_pools);
+  long long scanning_work = average(stats.total_scanning_work, stats.major_collections);
+  long long useful_scanning_work = average(stats.useful_scanning_work, stats.major_collections);
+  long long ring_operations_per_pool = average(stats.ring_operations, stats.total_alloced_pools);
 
   if (!boxroot_used()) return;
 
-  int64_t time_per_major =
+  long long time_per_major =
       stats.major_collections ? stats.total_major_time / stats.major_collections : 0;
 
-  printf("POOL_LOG_SIZE: %d (%'d KiB, %'d roots/pool)\n"
+  printf("POOL_LOG_SIZE: %d (%'lld KiB, %'d roots/pool)\n"
          "DEBUG: %d\n"
          "OCAML_MULTICORE: %d\n",
-         (int)POOL_LOG_SIZE, kib_of_pools((int)1, 1), (int)POOL_ROOTS_CAPACITY,
+         (int)POOL_LOG_SIZE, kib_of_pools(1, 1), (int)POOL_ROOTS_CAPACITY,
          (int)DEBUG, (int)OCAML_MULTICORE);
 
-  printf("total allocated pool: %'d (%'d MiB)\n"
-         "peak allocated pools: %'d (%'d MiB)\n"
-         "total freed pool: %'d (%'d MiB)\n",
+  printf("total allocated pool: %'lld (%'lld MiB)\n"
+         "peak allocated pools: %'lld (%'lld MiB)\n"
+         "total freed pool: %'lld (%'lld MiB)\n"
+         "total orphaned pools: %'lld\n",
          stats.total_alloced_pools,
          kib_of_pools(stats.total_alloced_pools, 2),
          stats.peak_pools,
          kib_of_pools(stats.peak_pools, 2),
          stats.total_freed_pools,
-         kib_of_pools(stats.total_freed_pools, 2));
+         kib_of_pools(stats.total_freed_pools, 2),
+         stats.total_orphaned_pools);
+
+  printf("pools visited per minor: %'lld\n",
+         average(stats.total_minor_work, stats.minor_collections));
 
-  printf("work per major: %'d (%'d useful)\n"
+  printf("work per major: %'lld (%'lld useful)\n"
          "total scanning work: %'lld (%'lld%% useful)\n",
          scanning_work, useful_scanning_work,
          stats.total_scanning_work,
@@ -692,19 +1226,26 @@ void rem_boxroot_print_stats()
 #if defined(POSIX_CLOCK)
   printf("average time per major: %'lldns\n"
          "peak time per major: %'lldns\n",
-         (long long)time_per_major,
-         (long long)stats.peak_major_time);
+         time_per_major,
+         stats.peak_major_time);
 #endif
 
-  printf("total ring operations: %'d\n"
-         "ring operations per pool: %'d\n",
+  printf("total rem_boxroot_create_slow: %'lld\n"
+         "total rem_boxroot_delete_slow: %'lld\n"
+         "total remote deallocations: %'lld\n",
+         stats.total_create_slow,
+         stats.total_delete_slow,
+         stats.total_remote_free);
+
+  printf("total ring operations: %'lld\n"
+         "ring operations per pool: %'lld\n",
          stats.ring_operations,
          ring_operations_per_pool);
 
 #if DEBUG != 0
-  printf("total created: %'d\n"
-         "total deleted: %'d\n"
-         "total modified: %'d\n",
+  printf("total created: %'lld\n"
+         "total deleted: %'lld\n"
+         "total modified: %'lld\n",
          stats.total_create,
          stats.total_delete,
          stats.total_modify);
@@ -725,7 +1266,7 @@ void rem_boxroot_print_stats()
          "roots created per pool work: %'lld\n"
          , stats.find_available_pool
          , stats.find_available_pool_work
-         , stats.total_create / stats.find_available_pool_work
+         , average(stats.total_create, stats.find_available_pool_work)
       );
 #endif
 }
@@ -734,69 +1275,85 @@ void rem_boxroot_print_stats()
 
 /* {{{ Hook setup */
 
-static int setup = 0;
-
+/* requires domain lock: YES
+   requires pool lock: NO */
 static void scanning_callback(scanning_action action, int only_young,
                               void *data)
 {
-  CRITICAL_SECTION_BEGIN();
-  if (!setup) {
-    CRITICAL_SECTION_END();
-    return;
-  }
+  (void)only_young;
+  if (!setup) return;
   int in_minor_collection = boxroot_in_minor_collection();
 
-  if (in_minor_collection) ++stats.minor_collections;
-  else ++stats.major_collections;
+  if (in_minor_collection) incr(&stats.minor_collections);
+  else incr(&stats.major_collections);
 
   // If no boxroot has been allocated, then scan_roots should not have
   // any noticeable cost. For experimental purposes, since this hook
   // is also used for other the statistics of other implementations,
   // we further make sure of this with an extra test, by avoiding
-  // calling scan_roots if it has only just been initialised.
-  if (boxroot_used()) {
-    int64_t start = time_counter();
-    scan_roots(action, data);
-    int64_t duration = time_counter() - start;
-    int64_t *total = &stats.total_major_time;
-    int64_t *peak = &stats.peak_major_time;
-    *total += duration;
-    if (duration > *peak) *peak = duration;
-  }
-  CRITICAL_SECTION_END();
+  // calling scan_roots if the domain has no pools.
+  int dom_id = Domain_id;
+  if (rings[dom_id] == NULL) return; /* synchronised by domain lock */
+  acquire_pool_rings(dom_id);
+#if !OCAML_MULTICORE
+  boxroot_check_thread_hooks();
+#endif
+  long long start = time_counter();
+  scan_roots(action, data, dom_id);
+  long long duration = time_counter() - start;
+  stats.total_major_time += duration;
+  if (duration > stats.peak_major_time) stats.peak_major_time = duration; // racy
+  release_pool_rings(dom_id);
+}
+
+/* Handle orphaning of domain-local pools */
+/* requires domain lock: YES
+   requires pool lock: NO */
+static void domain_termination_callback()
+{
+  DEBUGassert(OCAML_MULTICORE == 1);
+  orphan_pools(Domain_id);
 }
 
+/* Used for initialization/teardown */
+static mutex_t init_mutex = BOXROOT_MUTEX_INITIALIZER;
+
 // Must be called to set the hook before using boxroot
 int rem_boxroot_setup()
 {
-  CRITICAL_SECTION_BEGIN();
-  if (setup) {
-    CRITICAL_SECTION_END();
-    return 0;
-  }
-  // initialise globals
-  struct stats empty_stats = {0};
-  stats = empty_stats;
-  pools = NULL;
-  full_pools = NULL;
-  boxroot_setup_hooks(&scanning_callback, NULL);
+  int res = 0;
+  boxroot_mutex_lock(&init_mutex);
+  if (setup) goto out;
+  if (NULL == init_pool_rings(Orphaned_id)) goto out;
+  boxroot_setup_hooks(&scanning_callback, &domain_termination_callback,
+                      NULL);
   // we are done
   setup = 1;
-  CRITICAL_SECTION_END();
-  return 1;
+  res = 1;
+  // fall through
+ out:
+  boxroot_mutex_unlock(&init_mutex);
+  return res;
 }
 
 // This can only be called at OCaml shutdown
 void rem_boxroot_teardown()
 {
-  CRITICAL_SECTION_BEGIN();
-  if (!setup) {
-    CRITICAL_SECTION_END();
-    return;
-  }
+  boxroot_mutex_lock(&init_mutex);
+  if (!setup) goto out;
   setup = 0;
-  free_all_pools();
-  CRITICAL_SECTION_END();
+  for (int i = 0; i < Num_domains + 1; i++) {
+    pool_rings *ps = rings[i];
+    if (ps == NULL) continue;
+    free_pool_ring(&ps->pools);
+    free_pool_ring(&ps->full_pools);
+    free(ps);
+    rings[i] = NULL;
+    rem_boxroot_current_fl[i] = NULL;
+  }
+  // fall through
+ out:
+  boxroot_mutex_unlock(&init_mutex);
 }
 
 /* }}} */
@@ -2,7 +2,12 @@
 #ifndef REM_BOXROOT_H
 #define REM_BOXROOT_H
 
+#define CAML_NAME_SPACE
+
 #include <caml/mlvalues.h>
+#include <caml/address_class.h>
+#include "ocaml_hooks.h"
+#include "platform.h"
 
 typedef struct rem_boxroot_private* rem_boxroot;
 
@@ -10,8 +15,9 @@ typedef struct rem_boxroot_private* rem_boxroot;
    value `v`. This value will be considered as a root by the OCaml GC
    as long as the boxroot lives or until it is modified. A return
    value of `NULL` indicates a failure of allocation of the backing
-   store. */
-rem_boxroot rem_boxroot_create(value);
+   store. The OCaml domain lock must be held before calling
+   `rem_boxroot_create`. */
+inline rem_boxroot rem_boxroot_create(value);
 
 /* `rem_boxroot_get(r)` returns the contained value, subject to the usual
    discipline for non-rooted values. `rem_boxroot_get_ref(r)` returns a
@@ -24,8 +30,9 @@ inline value const * rem_boxroot_get_ref(rem_boxroot r) { return (value *)r; }
 
 /* `rem_boxroot_delete(r)` deallocates the boxroot `r`. The value is no
    longer considered as a root by the OCaml GC. The argument must be
-   non-null. */
-void rem_boxroot_delete(rem_boxroot);
+   non-null. The domain lock need not be held: deallocations by other
+   domains and threads are recorded for the domain owning the root. */
+inline void rem_boxroot_delete(rem_boxroot);
 
 /* `rem_boxroot_modify(&r,v)` changes the value kept alive by the boxroot
    `r` to `v`. It is equivalent to the following:
@@ -36,7 +43,8 @@ void rem_boxroot_delete(rem_boxroot);
    In particular, the root can be reallocated. However, unlike
    `rem_boxroot_create`, `rem_boxroot_modify` never fails, so `r` is
    guaranteed to be non-NULL afterwards. In addition, `rem_boxroot_modify`
-   is more efficient. */
+   is more efficient. The OCaml domain lock must be held before
+   calling `rem_boxroot_modify`. */
 void rem_boxroot_modify(rem_boxroot *, value);
 
 
@@ -51,4 +59,109 @@ void rem_boxroot_teardown();
 /* Show some statistics on the standard output. */
 void rem_boxroot_print_stats();
 
+/* Private implementation */
+
+typedef struct {
+  /* Free slots contain the address of the next free slot with the
+     low bit set. The empty list is denoted by the address of the
+     pool. */
+  void *major_free_list;
+  /* Free slots that are already part of the remembered set */
+  void *minor_free_list;
+  /* if minor_free_list is non-empty, points to its last cell */
+  void *last_minor_free_slot;
+  int alloc_count;
+#if OCAML_MULTICORE
+  atomic_int domain_id;
+#endif
+} rem_boxroot_fl;
+
+extern rem_boxroot_fl *rem_boxroot_current_fl[Num_domains + 1];
+
+void rem_boxroot_create_debug(value v);
+rem_boxroot rem_boxroot_create_slow(value v);
+
+/* Whether [v] is a block in the minor heap. With OCaml 5, this
+   includes the minor heaps of the other domains, whose values must
+   also be remembered (same as is_young_block in rem_boxroot.c). */
+#define Rem_is_young_block(v) (Is_block(v) && Is_young(v))
+
+inline rem_boxroot rem_boxroot_create(value init)
+{
+#if defined(BOXROOT_DEBUG) && (BOXROOT_DEBUG == 1)
+  rem_boxroot_create_debug(init);
+#endif
+  /* Find current freelist. Synchronized by domain lock. */
+  rem_boxroot_fl *fl = rem_boxroot_current_fl[Domain_id];
+  if (BOXROOT_UNLIKELY(fl == NULL)) goto slow;
+  /* Young values take slots that are already in the remembered set */
+  void **list = Rem_is_young_block(init)
+    ? &fl->minor_free_list : &fl->major_free_list;
+  void *new_root = *list;
+  if (BOXROOT_UNLIKELY(new_root == fl)) goto slow;
+  *list = (void *)(*(uintptr_t *)new_root - 1);
+  fl->alloc_count++;
+  *((value *)new_root) = init;
+  return (rem_boxroot)new_root;
+slow:
+  return rem_boxroot_create_slow(init);
+}
+
+/* Log of the size of the pools (12 = 4KB, an OS page).
+   Recommended: 14. */
+#define REM_POOL_LOG_SIZE 14
+/* Every REM_DEALLOC_THRESHOLD deallocations, check whether a full
+   pool can receive allocations again (see rem_boxroot.c). Must be a
+   power of 2. Deallocation also takes the slow path when the minor
+   free list of a pool becomes non-empty. */
+#define REM_DEALLOC_THRESHOLD ((int)((size_t)1 << REM_POOL_LOG_SIZE) / 64)
+
+#define Get_rem_pool_header(s)                                         \
+  ((void *)((uintptr_t)(s) & ~(((uintptr_t)1 << REM_POOL_LOG_SIZE) - 1)))
+
+#if OCAML_MULTICORE
+#define rem_dom_id_of_fl(fl)                                    \
+  atomic_load_explicit(&(fl)->domain_id, memory_order_relaxed)
+#else
+#define rem_dom_id_of_fl(fl) ((void)(fl),0)
+#endif
+
+inline int rem_boxroot_free_slot(rem_boxroot_fl *fl, rem_boxroot root)
+{
+  void **s = (void **)root;
+  void **list;
+  int first_minor = 0;
+  if (Rem_is_young_block(*(value *)s)) {
+    /* The slot stays in the remembered set until the next minor
+       collection */
+    list = &fl->minor_free_list;
+    if (BOXROOT_UNLIKELY(*list == fl)) {
+      fl->last_minor_free_slot = s;
+      /* The pool must be visited at the next minor collection */
+      first_minor = 1;
+    }
+  } else {
+    list = &fl->major_free_list;
+  }
+  *s = (void *)((uintptr_t)*list | 1);
+  *list = s;
+  int alloc_count = --fl->alloc_count;
+  return first_minor || (alloc_count & (REM_DEALLOC_THRESHOLD - 1)) == 0;
+}
+
+void rem_boxroot_delete_debug(rem_boxroot root);
+void rem_boxroot_delete_slow(rem_boxroot root);
+
+inline void rem_boxroot_delete(rem_boxroot root)
+{
+#if defined(BOXROOT_DEBUG) && (BOXROOT_DEBUG == 1)
+  rem_boxroot_delete_debug(root);
+#endif
+  rem_boxroot_fl *fl = Get_rem_pool_header(root);
+  int dom_id = rem_dom_id_of_fl(fl);
+  if (BOXROOT_UNLIKELY(!boxroot_domain_lock_held(dom_id))
+      || BOXROOT_UNLIKELY(rem_boxroot_free_slot(fl, root)))
+    rem_boxroot_delete_slow(root);
+}
+
 #endif // REM_BOXROOT_H
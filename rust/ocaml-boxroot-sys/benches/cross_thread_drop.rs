@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+// Throughput of dropping boxroots from threads that do not hold the
+// domain lock, compared to dropping them in the domain that allocated
+// them.
+// Run with: cargo bench --features "link-ocaml-runtime-and-dummy-program"
+
+use criterion::{criterion_group, criterion_main, BatchSize, Criterion, Throughput};
+use ocaml_boxroot_sys::safe::{flush_releases, BoxRoot, DomainLock};
+use std::sync::mpsc;
+use std::sync::Once;
+use std::thread;
+
+extern "C" {
+    fn caml_startup(argv: *const *const i8);
+    fn caml_minor_collection();
+}
+
+static STARTUP: Once = Once::new();
+
+fn startup() {
+    STARTUP.call_once(|| unsafe {
+        let arg0 = "ocaml\0".as_ptr() as *const i8;
+        let c_args = [arg0, core::ptr::null()];
+        caml_startup(c_args.as_ptr());
+    });
+}
+
+// Number of roots dropped per iteration
+const N: usize = 10_000;
+
+// Allocates the roots. The collection lets the domain take back the
+// slots freed remotely during the previous iteration.
+fn alloc_roots() -> Vec<BoxRoot<isize>> {
+    unsafe {
+        caml_minor_collection();
+        let lock = DomainLock::assume_held();
+        (0..N)
+            .map(|i| BoxRoot::new(&lock, ((i as isize) << 1) + 1).unwrap())
+            .collect()
+    }
+}
+
+fn cross_thread_drop(c: &mut Criterion) {
+    startup();
+    let mut group = c.benchmark_group("cross_thread_drop");
+    group.throughput(Throughput::Elements(N as u64));
+    group.bench_function("local", |b| {
+        b.iter_batched(alloc_roots, drop, BatchSize::PerIteration)
+    });
+    for workers in [1, 4] {
+        let mut senders = Vec::new();
+        let (done_tx, done_rx) = mpsc::channel();
+        let handles: Vec<_> = (0..workers)
+            .map(|_| {
+                let (tx, rx) = mpsc::channel::<Vec<BoxRoot<isize>>>();
+                senders.push(tx);
+                let done_tx = done_tx.clone();
+                thread::spawn(move || {
+                    for roots in rx {
+                        drop(roots);
+                        flush_releases();
+                        done_tx.send(()).unwrap();
+                    }
+                })
+            })
+            .collect();
+        group.bench_function(format!("remote/{}", workers), |b| {
+            b.iter_batched(
+                || {
+                    let mut roots = alloc_roots();
+                    let chunk = N / workers;
+                    (0..workers)
+                        .map(|_| roots.split_off(roots.len() - chunk))
+                        .collect::<Vec<_>>()
+                },
+                |chunks| {
+                    for (tx, roots) in senders.iter().zip(chunks) {
+                        tx.send(roots).unwrap();
+                    }
+                    for _ in 0..workers {
+                        done_rx.recv().unwrap();
+                    }
+                },
+                BatchSize::PerIteration,
+            )
+        });
+        drop(senders);
+        for h in handles {
+            h.join().unwrap();
+        }
+    }
+    group.finish();
+}
+
+criterion_group!(benches, cross_thread_drop);
+criterion_main!(benches);
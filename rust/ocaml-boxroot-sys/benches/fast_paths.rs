@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: MIT */
+// Compare the inlined fast paths of `fast` with calls to the C
+// functions.
+// Run with: cargo bench --features "link-ocaml-runtime-and-dummy-program"
+
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use ocaml_boxroot_sys::{boxroot_create, boxroot_delete, boxroot_get, fast, BoxRoot};
+use std::sync::Once;
+
+extern "C" {
+    fn caml_startup(argv: *const *const i8);
+}
+
+static STARTUP: Once = Once::new();
+
+fn startup() {
+    STARTUP.call_once(|| unsafe {
+        let arg0 = "ocaml\0".as_ptr() as *const i8;
+        let c_args = [arg0, core::ptr::null()];
+        caml_startup(c_args.as_ptr());
+    });
+}
+
+// Number of roots allocated at once
+const N: isize = 1000;
+
+fn val_int(i: isize) -> isize {
+    (i << 1) + 1
+}
+
+fn create_delete(c: &mut Criterion) {
+    startup();
+    let mut roots: Vec<BoxRoot> = Vec::with_capacity(N as usize);
+    let mut group = c.benchmark_group("create_delete");
+    group.bench_function("ffi", |b| {
+        b.iter(|| unsafe {
+            for i in 0..N {
+                roots.push(boxroot_create(black_box(val_int(i))));
+            }
+            for r in roots.drain(..) {
+                boxroot_delete(r);
+            }
+        })
+    });
+    group.bench_function("inline", |b| {
+        b.iter(|| unsafe {
+            for i in 0..N {
+                roots.push(fast::create(black_box(val_int(i))));
+            }
+            for r in roots.drain(..) {
+                fast::delete(r);
+            }
+        })
+    });
+    group.finish();
+}
+
+fn get(c: &mut Criterion) {
+    startup();
+    let roots: Vec<BoxRoot> = (0..N).map(|i| unsafe { fast::create(val_int(i)) }).collect();
+    let mut group = c.benchmark_group("get");
+    group.bench_function("ffi", |b| {
+        b.iter(|| roots.iter().fold(0, |acc, r| acc + unsafe { boxroot_get(*r) }))
+    });
+    group.bench_function("inline", |b| {
+        b.iter(|| roots.iter().fold(0, |acc, r| acc + unsafe { fast::get(*r) }))
+    });
+    group.finish();
+    for r in roots {
+        unsafe { fast::delete(r) }
+    }
+}
+
+criterion_group!(benches, create_delete, get);
+criterion_main!(benches);
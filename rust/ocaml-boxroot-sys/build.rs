@@ -1,11 +1,19 @@
 /* SPDX-License-Identifier: MIT */
 
+#[cfg(feature = "bundle-boxroot")]
+#[path = "src/layout.rs"]
+mod layout;
+
 #[cfg(feature = "bundle-boxroot")]
 fn build_boxroot() {
     println!("cargo:rerun-if-changed=vendor/boxroot/boxroot.c");
     println!("cargo:rerun-if-changed=vendor/boxroot/boxroot.h");
-    println!("cargo:rerun-if-changed=vendor/boxroot/ocaml_hook.c");
-    println!("cargo:rerun-if-changed=vendor/boxroot/ocaml_hook.h");
+    println!("cargo:rerun-if-changed=vendor/boxroot/ocaml_hooks.c");
+    println!("cargo:rerun-if-changed=vendor/boxroot/ocaml_hooks.h");
+    println!("cargo:rerun-if-changed=vendor/boxroot/platform.c");
+    println!("cargo:rerun-if-changed=vendor/boxroot/platform.h");
+    println!("cargo:rerun-if-changed=src/layout.rs");
+    println!("cargo:rerun-if-changed=src/layout_check.c");
     println!("cargo:rerun-if-env-changed=OCAMLOPT");
     println!("cargo:rerun-if-env-changed=OCAML_WHERE_PATH");
 
@@ -36,8 +44,18 @@ fn build_boxroot() {
     config.file("vendor/boxroot/ocaml_hooks.c");
     config.file("vendor/boxroot/platform.c");
 
+    let multicore = ocaml_version_major(&ocaml_path) >= 5;
+    define_layout(&mut config, multicore);
+    config.file("src/layout_check.c");
+
     config.compile("libocaml-boxroot.a");
 
+    // The layout is checked: use the fast paths of src/fast.rs
+    println!("cargo:rustc-cfg=boxroot_inline");
+    if multicore {
+        println!("cargo:rustc-cfg=boxroot_ocaml5");
+    }
+
     println!("cargo:rustc-link-search={}", out_dir.display());
     println!("cargo:rustc-link-lib=static=ocaml-boxroot");
 
@@ -45,6 +63,65 @@ fn build_boxroot() {
     link_runtime(out_dir, &ocamlopt, &ocaml_path).unwrap();
 }
 
+#[cfg(feature = "bundle-boxroot")]
+fn ocaml_version_major(ocaml_path: &str) -> u32 {
+    let version_h = std::path::Path::new(ocaml_path).join("caml/version.h");
+    let contents = std::fs::read_to_string(&version_h).unwrap();
+    contents
+        .lines()
+        .find_map(|l| l.trim().strip_prefix("#define OCAML_VERSION_MAJOR"))
+        .and_then(|v| v.trim().parse().ok())
+        .unwrap_or_else(|| panic!("no OCAML_VERSION_MAJOR in {}", version_h.display()))
+}
+
+#[cfg(feature = "bundle-boxroot")]
+macro_rules! offset_of {
+    ($ty:ty, $field:ident) => {{
+        let u = std::mem::MaybeUninit::<$ty>::uninit();
+        let base = u.as_ptr();
+        unsafe { std::ptr::addr_of!((*base).$field) as usize - base as usize }
+    }};
+}
+
+/* Pass the layout of src/layout.rs to src/layout_check.c, which fails
+   to compile if it does not match boxroot.h. */
+#[cfg(feature = "bundle-boxroot")]
+fn define_layout(config: &mut cc::Build, multicore: bool) {
+    use layout::*;
+    let fl = if multicore {
+        [
+            NUM_DOMAINS_5,
+            std::mem::size_of::<FreeList5>(),
+            offset_of!(FreeList5, next),
+            offset_of!(FreeList5, end),
+            offset_of!(FreeList5, alloc_count),
+            offset_of!(FreeList5, domain_id),
+        ]
+    } else {
+        [
+            NUM_DOMAINS_4,
+            std::mem::size_of::<FreeList4>(),
+            offset_of!(FreeList4, next),
+            offset_of!(FreeList4, end),
+            offset_of!(FreeList4, alloc_count),
+            0,
+        ]
+    };
+    let defines = [
+        ("POOL_LOG_SIZE", POOL_LOG_SIZE),
+        ("DEALLOC_THRESHOLD", DEALLOC_THRESHOLD as usize),
+        ("NUM_DOMAINS", fl[0]),
+        ("FL_SIZE", fl[1]),
+        ("FL_NEXT", fl[2]),
+        ("FL_END", fl[3]),
+        ("FL_ALLOC_COUNT", fl[4]),
+        ("FL_DOMAIN_ID", fl[5]),
+    ];
+    for (name, v) in defines.iter() {
+        config.define(&format!("BOXROOT_RUST_{}", name), Some(&v.to_string()[..]));
+    }
+}
+
 #[cfg(feature = "link-ocaml-runtime-and-dummy-program")]
 fn link_runtime(
     out_dir: std::path::PathBuf,
@@ -99,6 +176,8 @@ fn link_runtime(
 }
 
 fn main() {
+    println!("cargo:rustc-check-cfg=cfg(boxroot_inline)");
+    println!("cargo:rustc-check-cfg=cfg(boxroot_ocaml5)");
     #[cfg(feature = "bundle-boxroot")]
     build_boxroot();
 }
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: MIT */
+//! Rust versions of the inline functions of `boxroot.h`. The C
+//! functions of the same name are only available out-of-line from
+//! Rust; these avoid the call in the fast path of allocation and
+//! deallocation.
+//!
+//! They rely on the private layout of `boxroot.h` (see `layout.rs`),
+//! which is checked at compile time when boxroot is built by this
+//! crate (feature `bundle-boxroot`). Otherwise, they call the C
+//! functions.
+//!
+//! The requirements are the same as for the C functions: the OCaml
+//! domain lock must be held for [`create`], [`get`] and [`get_ref`].
+
+use crate::{BoxRoot, Value};
+
+#[cfg(not(boxroot_inline))]
+pub use crate::{boxroot_create as create, boxroot_delete as delete};
+
+#[cfg(boxroot_inline)]
+pub use self::inline::{create, delete};
+
+/// `boxroot_get`
+///
+/// # Safety
+///
+/// `br` must be a valid boxroot, and the domain lock must be held.
+#[inline(always)]
+pub unsafe fn get(br: BoxRoot) -> Value {
+    *br
+}
+
+/// `boxroot_get_ref`
+///
+/// # Safety
+///
+/// `br` must be a valid boxroot, and the domain lock must be held.
+#[inline(always)]
+pub unsafe fn get_ref(br: BoxRoot) -> *const Value {
+    br
+}
+
+#[cfg(boxroot_inline)]
+mod inline {
+    use crate::layout::{DEALLOC_THRESHOLD, POOL_SIZE};
+    use crate::{BoxRoot, Value};
+    use std::cell::Cell;
+    use std::os::raw::{c_int, c_void};
+    use std::ptr;
+
+    #[cfg(not(boxroot_ocaml5))]
+    use crate::layout::{FreeList4 as FreeList, NUM_DOMAINS_4 as NUM_DOMAINS};
+    #[cfg(boxroot_ocaml5)]
+    use crate::layout::{FreeList5 as FreeList, NUM_DOMAINS_5 as NUM_DOMAINS};
+
+    extern "C" {
+        static mut boxroot_current_fl: [*mut FreeList; NUM_DOMAINS + 1];
+        fn boxroot_create_slow(v: Value) -> BoxRoot;
+        fn boxroot_delete_slow(br: BoxRoot);
+        fn boxroot_thread_local_ref() -> *mut c_void;
+    }
+
+    #[cfg(boxroot_ocaml5)]
+    extern "C" {
+        static boxroot_domain_state_id_offset: usize;
+    }
+
+    #[cfg(not(boxroot_ocaml5))]
+    extern "C" {
+        static mut caml_leave_blocking_section_hook: Option<unsafe extern "C" fn()>;
+        fn boxroot_leave_blocking_section();
+    }
+
+    thread_local! {
+        /* Cache of boxroot_thread_local_ref() */
+        static THREAD_LOCAL_REF: Cell<*mut c_void> = const { Cell::new(ptr::null_mut()) };
+    }
+
+    #[inline(always)]
+    unsafe fn thread_local_ref() -> *mut c_void {
+        THREAD_LOCAL_REF.with(|r| {
+            let mut p = r.get();
+            if p.is_null() {
+                p = boxroot_thread_local_ref();
+                r.set(p);
+            }
+            p
+        })
+    }
+
+    /* Caml_state->id, or -1 if Caml_state is NULL */
+    #[cfg(boxroot_ocaml5)]
+    #[inline(always)]
+    unsafe fn current_domain_id() -> c_int {
+        let dom_st = *(thread_local_ref() as *const *const u8);
+        if dom_st.is_null() {
+            return -1;
+        }
+        *(dom_st.add(boxroot_domain_state_id_offset) as *const c_int)
+    }
+
+    /* Domain_id */
+    #[cfg(boxroot_ocaml5)]
+    #[inline(always)]
+    unsafe fn domain_id() -> usize {
+        current_domain_id() as usize
+    }
+
+    #[cfg(not(boxroot_ocaml5))]
+    #[inline(always)]
+    unsafe fn domain_id() -> usize {
+        0
+    }
+
+    /* boxroot_domain_lock_held */
+    #[cfg(boxroot_ocaml5)]
+    #[inline(always)]
+    unsafe fn domain_lock_held(dom_id: c_int) -> bool {
+        current_domain_id() == dom_id
+    }
+
+    #[cfg(not(boxroot_ocaml5))]
+    #[inline(always)]
+    unsafe fn domain_lock_held(_dom_id: c_int) -> bool {
+        *(thread_local_ref() as *const c_int) != 0
+            && ptr::addr_of!(caml_leave_blocking_section_hook)
+                .read()
+                .map(|f| f as usize)
+                == Some(boxroot_leave_blocking_section as usize)
+    }
+
+    /* dom_id_of_fl */
+    #[cfg(boxroot_ocaml5)]
+    #[inline(always)]
+    unsafe fn dom_id_of_fl(fl: *mut FreeList) -> c_int {
+        (*fl).domain_id.load(std::sync::atomic::Ordering::Relaxed)
+    }
+
+    #[cfg(not(boxroot_ocaml5))]
+    #[inline(always)]
+    unsafe fn dom_id_of_fl(_fl: *mut FreeList) -> c_int {
+        0
+    }
+
+    /// `boxroot_create`
+    ///
+    /// # Safety
+    ///
+    /// `init` must be a valid OCaml value, and the domain lock must be
+    /// held.
+    #[inline(always)]
+    pub unsafe fn create(init: Value) -> BoxRoot {
+        let dom_id = domain_id();
+        if dom_id >= NUM_DOMAINS {
+            /* No domain state: let the C function fail */
+            return boxroot_create_slow(init);
+        }
+        /* Find current freelist. Synchronized by domain lock. */
+        let fl = *ptr::addr_of!(boxroot_current_fl)
+            .cast::<*mut FreeList>()
+            .add(dom_id);
+        if fl.is_null() {
+            return boxroot_create_slow(init);
+        }
+        let new_root = (*fl).next;
+        if new_root == fl as *mut c_void {
+            return boxroot_create_slow(init);
+        }
+        (*fl).next = *(new_root as *mut *mut c_void);
+        (*fl).alloc_count += 1;
+        *(new_root as *mut Value) = init;
+        new_root as BoxRoot
+    }
+
+    /* boxroot_free_slot */
+    #[inline(always)]
+    unsafe fn free_slot(fl: *mut FreeList, root: BoxRoot) -> bool {
+        let s = root as *mut *mut c_void;
+        let n = (*fl).next;
+        *s = n;
+        if n == fl as *mut c_void {
+            (*fl).end = s as *mut c_void;
+        }
+        (*fl).next = s as *mut c_void;
+        (*fl).alloc_count -= 1;
+        ((*fl).alloc_count & (DEALLOC_THRESHOLD - 1)) == 0
+    }
+
+    /// `boxroot_delete`
+    ///
+    /// # Safety
+    ///
+    /// `root` must be a valid boxroot, which is no longer used
+    /// afterwards.
+    #[inline(always)]
+    pub unsafe fn delete(root: BoxRoot) {
+        let fl = (root as usize & !(POOL_SIZE - 1)) as *mut FreeList;
+        let dom_id = dom_id_of_fl(fl);
+        if !domain_lock_held(dom_id) || free_slot(fl, root) {
+            boxroot_delete_slow(root);
+        }
+    }
+}
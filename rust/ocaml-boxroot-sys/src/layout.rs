@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: MIT */
+//! Private part of `boxroot.h` mirrored by the fast paths of
+//! `fast.rs`. Also included by `build.rs`, which checks it against the
+//! C headers when building boxroot (see `layout_check.c`).
+#![allow(dead_code)]
+
+use std::os::raw::{c_int, c_void};
+use std::sync::atomic::AtomicI32;
+
+/// `POOL_LOG_SIZE`
+pub const POOL_LOG_SIZE: usize = 14;
+/// `POOL_SIZE`
+pub const POOL_SIZE: usize = 1 << POOL_LOG_SIZE;
+/// `DEALLOC_THRESHOLD`
+pub const DEALLOC_THRESHOLD: c_int = (POOL_SIZE / 2) as c_int;
+
+/// `Num_domains` with OCaml 4
+pub const NUM_DOMAINS_4: usize = 1;
+/// `Num_domains` with OCaml 5
+pub const NUM_DOMAINS_5: usize = 128;
+
+/// `boxroot_fl` with OCaml 4
+#[repr(C)]
+pub struct FreeList4 {
+    pub next: *mut c_void,
+    pub end: *mut c_void,
+    pub alloc_count: c_int,
+}
+
+/// `boxroot_fl` with OCaml 5
+#[repr(C)]
+pub struct FreeList5 {
+    pub next: *mut c_void,
+    pub end: *mut c_void,
+    pub alloc_count: c_int,
+    pub domain_id: AtomicI32,
+}
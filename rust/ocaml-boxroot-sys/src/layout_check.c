@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: MIT */
+/* Compile-time check that the layout assumed by the Rust fast paths
+   (src/layout.rs), passed by build.rs, matches boxroot.h. */
+#define CAML_NAME_SPACE
+#define CAML_INTERNALS
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "boxroot.h"
+#if OCAML_MULTICORE
+#include <caml/domain_state.h>
+#endif
+
+#define CHECK_LAYOUT(c, rust)                                       \
+  static_assert((c) == (rust), #c " does not match src/layout.rs")
+
+CHECK_LAYOUT(POOL_LOG_SIZE, BOXROOT_RUST_POOL_LOG_SIZE);
+CHECK_LAYOUT(DEALLOC_THRESHOLD, BOXROOT_RUST_DEALLOC_THRESHOLD);
+CHECK_LAYOUT(Num_domains, BOXROOT_RUST_NUM_DOMAINS);
+CHECK_LAYOUT(BOXROOT_MULTITHREAD, 1);
+CHECK_LAYOUT(BOXROOT_FORCE_REMOTE, 0);
+CHECK_LAYOUT(sizeof(boxroot_fl), BOXROOT_RUST_FL_SIZE);
+CHECK_LAYOUT(offsetof(boxroot_fl, next), BOXROOT_RUST_FL_NEXT);
+CHECK_LAYOUT(offsetof(boxroot_fl, end), BOXROOT_RUST_FL_END);
+CHECK_LAYOUT(offsetof(boxroot_fl, alloc_count), BOXROOT_RUST_FL_ALLOC_COUNT);
+#if OCAML_MULTICORE
+CHECK_LAYOUT(offsetof(boxroot_fl, domain_id), BOXROOT_RUST_FL_DOMAIN_ID);
+/* The domain id is read as a C int */
+CHECK_LAYOUT(sizeof(((caml_domain_state *)NULL)->id), sizeof(int));
+#endif
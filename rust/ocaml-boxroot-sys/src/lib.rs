@@ -2,12 +2,117 @@
 pub type Value = isize;
 pub type BoxRoot = *const Value;
 
+use std::os::raw::{c_int, c_longlong};
+
+/// `BOXROOT_STATS_VERSION`
+pub const BOXROOT_STATS_VERSION: c_int = 2;
+
+/// `struct boxroot_pool_counts`
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct boxroot_pool_counts {
+    pub young: c_longlong,
+    pub old: c_longlong,
+    pub free: c_longlong,
+}
+
+/// `BOXROOT_SCAN_HIST_BUCKETS`
+pub const BOXROOT_SCAN_HIST_BUCKETS: usize = 97;
+/// `BOXROOT_SCAN_HIST_POOL_CLASSES`
+pub const BOXROOT_SCAN_HIST_POOL_CLASSES: usize = 7;
+/// `BOXROOT_SCAN_MINOR`
+pub const BOXROOT_SCAN_MINOR: c_int = 0;
+/// `BOXROOT_SCAN_MAJOR`
+pub const BOXROOT_SCAN_MAJOR: c_int = 1;
+
+/// `struct boxroot_scan_histogram`
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct boxroot_scan_histogram {
+    pub version: c_int,
+    pub domain_id: c_int,
+    pub counts: [[[c_longlong; BOXROOT_SCAN_HIST_BUCKETS]; BOXROOT_SCAN_HIST_POOL_CLASSES]; 2],
+}
+
+/// `struct boxroot_stats`
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct boxroot_stats {
+    pub version: c_int,
+    pub num_domains: c_int,
+    pub minor_collections: c_longlong,
+    pub major_collections: c_longlong,
+    pub major_slices: c_longlong,
+    pub create_slow: c_longlong,
+    pub delete_slow: c_longlong,
+    pub remote_flushes: c_longlong,
+    pub handoffs: c_longlong,
+    pub scanning_work_minor: c_longlong,
+    pub scanning_work_major: c_longlong,
+    pub minor_time_total: c_longlong,
+    pub minor_time_peak: c_longlong,
+    pub major_time_total: c_longlong,
+    pub major_time_peak: c_longlong,
+    pub alloced_pools: c_longlong,
+    pub emptied_pools: c_longlong,
+    pub freed_pools: c_longlong,
+    pub live_pools: c_longlong,
+    pub peak_pools: c_longlong,
+    pub pools: boxroot_pool_counts,
+}
+
+/// `struct boxroot_domain_stats`
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct boxroot_domain_stats {
+    pub version: c_int,
+    pub domain_id: c_int,
+    pub pools: boxroot_pool_counts,
+    pub minor_collections: c_longlong,
+    pub major_collections: c_longlong,
+    pub create_slow: c_longlong,
+    pub delete_slow: c_longlong,
+    pub remote_flushes: c_longlong,
+    pub handoffs: c_longlong,
+    pub scanning_work_minor: c_longlong,
+    pub scanning_work_major: c_longlong,
+    pub minor_time_total: c_longlong,
+    pub minor_time_peak: c_longlong,
+    pub major_time_total: c_longlong,
+    pub major_time_peak: c_longlong,
+}
+
+pub mod fast;
+mod layout;
+pub mod safe;
+
 extern "C" {
     pub fn boxroot_create(v: Value) -> BoxRoot;
     pub fn boxroot_get(br: BoxRoot) -> Value;
     pub fn boxroot_get_ref(br: BoxRoot) -> *const Value;
     pub fn boxroot_delete(br: BoxRoot);
+    pub fn boxroot_flush_releases();
     pub fn boxroot_modify(br: *mut BoxRoot, v: Value);
+    pub fn boxroot_migrate(br: *mut BoxRoot) -> c_int;
+    pub fn boxroot_get_stats(out: *mut boxroot_stats, size: usize) -> usize;
+    pub fn boxroot_get_domain_stats(
+        domain_id: c_int,
+        out: *mut boxroot_domain_stats,
+        size: usize,
+    ) -> usize;
+    pub fn boxroot_reset_stats();
+    pub fn boxroot_get_scan_histogram(
+        domain_id: c_int,
+        out: *mut boxroot_scan_histogram,
+        size: usize,
+    ) -> usize;
+    pub fn boxroot_scan_histogram_ns(b: c_int) -> c_longlong;
+    pub fn boxroot_scan_histogram_pools(c: c_int) -> c_longlong;
+    pub fn boxroot_scan_histogram_percentile(
+        h: *const boxroot_scan_histogram,
+        kind: c_int,
+        p: f64,
+    ) -> c_longlong;
     pub fn boxroot_setup();
     pub fn boxroot_teardown();
 }
@@ -17,8 +122,11 @@ extern "C" {
 #[cfg(test)]
 mod tests {
     use crate::{
-        boxroot_create, boxroot_delete, boxroot_get, boxroot_get_ref, boxroot_modify,
-        boxroot_setup, boxroot_teardown,
+        boxroot_create, boxroot_delete, boxroot_get, boxroot_get_domain_stats, boxroot_get_ref,
+        boxroot_get_scan_histogram, boxroot_get_stats, boxroot_migrate, boxroot_modify,
+        boxroot_scan_histogram, boxroot_setup, boxroot_teardown, fast,
+        safe::{flush_releases, BoxRoot, DomainLock},
+        BOXROOT_STATS_VERSION,
     };
 
     extern "C" {
@@ -41,10 +149,57 @@ mod tests {
             boxroot_modify(&mut br, 2);
             let v2 = boxroot_get(br);
 
+            // Already in the pools of the current domain
+            let migrated = boxroot_migrate(&mut br);
+            let v3 = boxroot_get(br);
+
             boxroot_delete(br);
 
+            // Inlined fast paths
+            let br = fast::create(3);
+            let v4 = fast::get(br);
+            fast::delete(br);
+
+            // Owning wrapper
+            let lock = DomainLock::assume_held();
+            let mut r: BoxRoot<isize> = BoxRoot::new(&lock, 4).unwrap();
+            r.modify(&lock, 5);
+            let r2 = r.clone_with(&lock).unwrap();
+            drop(r);
+            let v5 = r2.get(&lock);
+            drop(r2);
+
+            // Dropped by a thread that does not hold the domain lock
+            let r3: BoxRoot<isize> = BoxRoot::new(&lock, 6).unwrap();
+            std::thread::spawn(move || {
+                drop(r3);
+                flush_releases();
+            })
+            .join()
+            .unwrap();
+
+            // Structured statistics
+            let mut stats = Default::default();
+            let size = boxroot_get_stats(&mut stats, std::mem::size_of_val(&stats));
+            let mut dom_stats = Default::default();
+            let dom_size =
+                boxroot_get_domain_stats(0, &mut dom_stats, std::mem::size_of_val(&dom_stats));
+            let mut hist: boxroot_scan_histogram = std::mem::zeroed();
+            let hist_size = boxroot_get_scan_histogram(-1, &mut hist, std::mem::size_of_val(&hist));
+
             assert_eq!(v1, 1);
             assert_eq!(v2, 2);
+            assert_eq!(migrated, 1);
+            assert_eq!(v3, 2);
+            assert_eq!(v4, 3);
+            assert_eq!(v5, 5);
+            assert_eq!(size, std::mem::size_of_val(&stats));
+            assert_eq!(stats.version, BOXROOT_STATS_VERSION);
+            assert!(stats.pools.young + stats.pools.old > 0);
+            assert_eq!(dom_size, std::mem::size_of_val(&dom_stats));
+            assert_eq!(dom_stats.domain_id, 0);
+            assert_eq!(hist_size, std::mem::size_of_val(&hist));
+            assert_eq!(hist.domain_id, -1);
 
             boxroot_teardown();
 
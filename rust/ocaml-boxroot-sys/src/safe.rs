@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: MIT */
+//! An owning wrapper for boxroots, which deletes the boxroot when
+//! dropped.
+//!
+//! Creating, reading and modifying a boxroot requires the OCaml domain
+//! lock, which is witnessed by a [`DomainLock`]. Dropping does not: a
+//! [`BoxRoot`] can be sent to and dropped by threads that do not hold
+//! the lock of the domain that allocated it. Such deallocations do not
+//! take a lock: the value stays alive until the next collection of
+//! that domain, which completes them.
+
+use crate::{boxroot_flush_releases, boxroot_modify, fast, BoxRoot as RawBoxRoot, Value};
+use std::marker::PhantomData;
+use std::mem;
+
+/// Witness that the current thread holds the OCaml domain lock (the
+/// runtime lock with OCaml 4).
+pub struct DomainLock {
+    _not_send: PhantomData<*const ()>,
+}
+
+impl DomainLock {
+    /// # Safety
+    ///
+    /// The current thread must hold the OCaml domain lock as long as
+    /// the returned value lives.
+    pub unsafe fn assume_held() -> DomainLock {
+        DomainLock {
+            _not_send: PhantomData,
+        }
+    }
+}
+
+/// A boxroot keeping alive an OCaml value of type `T`. It uses the
+/// inlined fast paths of [`fast`].
+///
+/// When dropped by a thread that does not hold the lock of the domain
+/// that allocated it, the value is released at the next collection of
+/// that domain. If boxroot is built with `BOXROOT_REMOTE_BUFFER` set
+/// to a positive size, such drops are instead buffered by the dropping
+/// thread, and only that thread flushes its buffer: a thread that
+/// drops a few boxroots and then stays idle keeps their values alive
+/// until it terminates or calls [`flush_releases`].
+pub struct BoxRoot<T> {
+    root: RawBoxRoot,
+    _marker: PhantomData<*const T>,
+}
+
+impl<T> BoxRoot<T> {
+    /// Allocates a boxroot initialised to `v`. Returns `None` on
+    /// allocation failure.
+    ///
+    /// # Safety
+    ///
+    /// `v` must be a valid OCaml value of type `T`.
+    pub unsafe fn new(_lock: &DomainLock, v: Value) -> Option<BoxRoot<T>> {
+        let root = fast::create(v);
+        if root.is_null() {
+            None
+        } else {
+            Some(Self::from_raw(root))
+        }
+    }
+
+    /// The value kept alive, subject to the usual discipline for
+    /// non-rooted values.
+    pub fn get(&self, _lock: &DomainLock) -> Value {
+        unsafe { fast::get(self.root) }
+    }
+
+    /// Changes the value kept alive. The boxroot can be reallocated,
+    /// but this never fails.
+    ///
+    /// # Safety
+    ///
+    /// `v` must be a valid OCaml value of type `T`.
+    pub unsafe fn modify(&mut self, _lock: &DomainLock, v: Value) {
+        boxroot_modify(&mut self.root, v)
+    }
+
+    /// Allocates a new boxroot for the same value. Returns `None` on
+    /// allocation failure. `Clone` is not implemented, since it would
+    /// require the domain lock.
+    pub fn clone_with(&self, lock: &DomainLock) -> Option<BoxRoot<T>> {
+        unsafe { Self::new(lock, self.get(lock)) }
+    }
+
+    /// The underlying boxroot, still owned by `self`.
+    pub fn as_raw(&self) -> RawBoxRoot {
+        self.root
+    }
+
+    /// Gives up ownership of the underlying boxroot.
+    pub fn into_raw(self) -> RawBoxRoot {
+        let root = self.root;
+        mem::forget(self);
+        root
+    }
+
+    /// # Safety
+    ///
+    /// `root` must be a non-null boxroot containing a value of type `T`,
+    /// owned by the caller, whose ownership is transferred.
+    pub unsafe fn from_raw(root: RawBoxRoot) -> BoxRoot<T> {
+        BoxRoot {
+            root,
+            _marker: PhantomData,
+        }
+    }
+}
+
+// The value is only accessed with the domain lock, whose witness is
+// not Send. Deallocation and modification work from any thread.
+unsafe impl<T> Send for BoxRoot<T> {}
+unsafe impl<T> Sync for BoxRoot<T> {}
+
+impl<T> Drop for BoxRoot<T> {
+    fn drop(&mut self) {
+        unsafe { fast::delete(self.root) }
+    }
+}
+
+/// Completes the deallocations buffered by the current thread, so that
+/// the values of the boxroots it has dropped are no longer kept alive.
+/// This is otherwise done when the buffer is full, at the first drop
+/// following a collection, and when the thread terminates. It does
+/// nothing unless boxroot is built with `BOXROOT_REMOTE_BUFFER` (see
+/// [`BoxRoot`]). It does not require the domain lock.
+pub fn flush_releases() {
+    unsafe { boxroot_flush_releases() }
+}